@@ -0,0 +1,67 @@
+#pragma once
+
+#include "GameLogic.h"
+#include "SparseBoard.h"
+
+#include <iterator>
+#include <variant>
+
+// The event sea carries the huge fleet this many times over. At well under
+// one percent ships a dense board would be almost all water.
+static const int EVENT_FLEET_COPIES = 100;
+
+// A board of any mode, for games whose mode is picked at runtime. Calls are
+// dispatched once to the variant, whose own code runs from there.
+class AnyBoard {
+public:
+  // Replaces the board with an empty one of mode.
+  void reset(BoardMode mode) {
+    switch (mode) {
+    case MODE_LARGE:
+      boards.emplace<MODE_LARGE>();
+      break;
+    case MODE_HUGE:
+      boards.emplace<MODE_HUGE>();
+      break;
+    case MODE_EVENT:
+      boards.emplace<MODE_EVENT>(BOARD_MODE_SIZES[MODE_EVENT],
+                                 HugeFleet::SHIPS,
+                                 (int)std::size(HugeFleet::SHIPS),
+                                 EVENT_FLEET_COPIES);
+      break;
+    default:
+      boards.emplace<MODE_CLASSIC>();
+      break;
+    }
+  }
+
+  BoardMode mode() const { return (BoardMode)boards.index(); }
+  int size() const { return BOARD_MODE_SIZES[boards.index()]; }
+
+  void placeShips(Xoshiro256 &rng, bool noTouching) {
+    std::visit([&](auto &board) { board.placeShips(rng, noTouching); },
+               boards);
+  }
+
+  ShotResult processShot(int x, int y) {
+    return std::visit([&](auto &board) { return board.processShot(x, y); },
+                      boards);
+  }
+
+  int getCell(int x, int y) const {
+    return std::visit([&](const auto &board) { return board.getCell(x, y); },
+                      boards);
+  }
+
+  void getViewport(int left, int top, int side, char *cells,
+                   bool showShips) const {
+    std::visit(
+        [&](const auto &board) {
+          board.getViewport(left, top, side, cells, showShips);
+        },
+        boards);
+  }
+
+private:
+  std::variant<ClassicBoard, LargeBoard, HugeBoard, SparseBoard> boards;
+};
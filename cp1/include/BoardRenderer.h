@@ -0,0 +1,89 @@
+#pragma once
+
+#include "protocol.h"
+
+#include <string>
+
+// Draws the client's copy of both boards.
+//
+// On a terminal the boards get a fixed pane at the top of the screen, with
+// messages and input scrolling in the rest of it, and only cells that
+// changed since the last render() are redrawn, each with a cursor jump
+// that returns to where the user is typing. A shot then costs a few dozen
+// bytes instead of both boards. Anywhere else (a pipe, a file, a terminal
+// too small for the pane) every change prints the whole board like before.
+class BoardRenderer {
+public:
+  BoardRenderer();
+
+  // An S_BOARD window of a size x size board. False if it does not fit.
+  bool setWindow(BoardId board, int size, int left, int top,
+                 const char *cells);
+  // count S_BOARD_DELTA cell updates; cells outside the window are ignored.
+  void updateCells(BoardId board, const char *updates, int count);
+
+  // Titles above the boards; movable adds the /view hint to the window
+  // range of a board larger than the window.
+  void setTitles(const std::string &own, const std::string &radar,
+                 bool movable);
+
+  int left(BoardId board) const { return views[board].left; }
+  int top(BoardId board) const { return views[board].top; }
+  // True while changes are drawn in place rather than printed.
+  bool inPlace() const { return paneRows > 0; }
+
+  // Appends the drawing of whatever changed to out. The pane is set up at
+  // the front of out, ahead of any text out carries for below the boards.
+  void render(std::string &out);
+  // Hands the whole screen back to scrolling text and forgets the boards.
+  void release(std::string &out);
+
+private:
+  struct View {
+    int left = 0;
+    int top = 0;
+    bool received = false;
+    char cells[VIEWPORT_SIZE * VIEWPORT_SIZE] = {};
+  };
+
+  // What is on screen, to diff the views against.
+  struct Shown {
+    bool drawn = false;
+    int left = 0;
+    int top = 0;
+    char cells[VIEWPORT_SIZE * VIEWPORT_SIZE] = {};
+  };
+
+  bool terminal;
+  int boardSize;
+  std::string titles[2];
+  bool movable;
+  View views[2];
+  bool changed[2];
+
+  // The pane, while one is set up: its height, the screen height it was
+  // laid out for, and the layout of each board in it.
+  int paneRows;
+  int screenRows;
+  int labelWidth;
+  int cellWidth;
+  int panelWidth;
+  Shown shown[2];
+  // The board size or titles changed since the pane was laid out.
+  bool layoutStale;
+
+  int side() const { return viewportSide(boardSize); }
+  int panelColumn(BoardId board) const {
+    return 1 + board * (panelWidth + PANEL_GAP);
+  }
+
+  void renderPlain(BoardId board, std::string &out) const;
+  bool setUpPane(std::string &out);
+  void drawPanel(BoardId board, std::string &out);
+  void drawChanges(BoardId board, std::string &out);
+  std::string rangeLine(int left, int top) const;
+
+  static const int PANEL_GAP = 4;
+  // Rows kept for messages and input below the pane.
+  static const int MIN_TEXT_ROWS = 6;
+};
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Open-addressing hash tables keyed by a cell index (y * size + x), for
+// boards too large to keep a bit or a byte per cell. Linear probing over a
+// power-of-two array kept at most half full. Cells are never removed: a
+// board only gains ships and shots until it is thrown away.
+namespace cellhash {
+
+static const uint32_t NO_CELL = UINT32_MAX;
+static const size_t MIN_CAPACITY = 16;
+
+// The slot holding cell, or the free slot it would go to. Fibonacci hashing
+// keeps the rows of a wide board from piling up.
+inline size_t slotOf(const std::vector<uint32_t> &keys, int shift,
+                     uint32_t cell) {
+  size_t mask = keys.size() - 1;
+  size_t slot = (uint32_t)(cell * 2654435769u) >> shift;
+  while (keys[slot] != cell && keys[slot] != NO_CELL) {
+    slot = (slot + 1) & mask;
+  }
+  return slot;
+}
+
+inline int shiftFor(size_t capacity) {
+  int shift = 32;
+  for (size_t bits = capacity; bits > 1; bits /= 2) {
+    --shift;
+  }
+  return shift;
+}
+
+inline size_t capacityFor(size_t entries) {
+  size_t capacity = MIN_CAPACITY;
+  while (capacity < 2 * entries) {
+    capacity *= 2;
+  }
+  return capacity;
+}
+
+} // namespace cellhash
+
+// A set of cells, four bytes per slot.
+class CellSet {
+public:
+  CellSet() { rehash(cellhash::MIN_CAPACITY); }
+
+  size_t size() const { return count; }
+
+  void reserve(size_t entries) {
+    size_t capacity = cellhash::capacityFor(entries);
+    if (capacity > keys.size()) {
+      rehash(capacity);
+    }
+  }
+
+  bool contains(uint32_t cell) const {
+    return keys[cellhash::slotOf(keys, shift, cell)] == cell;
+  }
+
+  // False if cell was already in the set.
+  bool insert(uint32_t cell) {
+    if (2 * (count + 1) > keys.size()) {
+      rehash(2 * keys.size());
+    }
+    size_t slot = cellhash::slotOf(keys, shift, cell);
+    if (keys[slot] == cell) {
+      return false;
+    }
+    keys[slot] = cell;
+    ++count;
+    return true;
+  }
+
+private:
+  std::vector<uint32_t> keys;
+  size_t count = 0;
+  int shift = 0;
+
+  void rehash(size_t capacity) {
+    std::vector<uint32_t> old(capacity, cellhash::NO_CELL);
+    old.swap(keys);
+    shift = cellhash::shiftFor(capacity);
+    for (uint32_t cell : old) {
+      if (cell != cellhash::NO_CELL) {
+        keys[cellhash::slotOf(keys, shift, cell)] = cell;
+      }
+    }
+  }
+};
+
+// Maps cells to a Value.
+template <typename Value> class CellMap {
+public:
+  CellMap() { rehash(cellhash::MIN_CAPACITY); }
+
+  size_t size() const { return count; }
+
+  void reserve(size_t entries) {
+    size_t capacity = cellhash::capacityFor(entries);
+    if (capacity > keys.size()) {
+      rehash(capacity);
+    }
+  }
+
+  // nullptr if cell is not in the map.
+  const Value *find(uint32_t cell) const {
+    size_t slot = cellhash::slotOf(keys, shift, cell);
+    return keys[slot] == cell ? &values[slot] : nullptr;
+  }
+
+  // Adds or overwrites the entry of cell.
+  void insert(uint32_t cell, const Value &value) {
+    if (2 * (count + 1) > keys.size()) {
+      rehash(2 * keys.size());
+    }
+    size_t slot = cellhash::slotOf(keys, shift, cell);
+    if (keys[slot] != cell) {
+      keys[slot] = cell;
+      ++count;
+    }
+    values[slot] = value;
+  }
+
+private:
+  std::vector<uint32_t> keys;
+  std::vector<Value> values;
+  size_t count = 0;
+  int shift = 0;
+
+  void rehash(size_t capacity) {
+    std::vector<uint32_t> oldKeys(capacity, cellhash::NO_CELL);
+    std::vector<Value> oldValues(capacity);
+    oldKeys.swap(keys);
+    oldValues.swap(values);
+    shift = cellhash::shiftFor(capacity);
+    for (size_t i = 0; i < oldKeys.size(); ++i) {
+      if (oldKeys[i] != cellhash::NO_CELL) {
+        size_t slot = cellhash::slotOf(keys, shift, oldKeys[i]);
+        keys[slot] = oldKeys[i];
+        values[slot] = oldValues[i];
+      }
+    }
+  }
+};
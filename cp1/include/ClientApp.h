@@ -1,28 +1,72 @@
 #pragma once
 
+#include "BoardRenderer.h"
+#include "Transport.h"
 #include "protocol.h"
-#include "wrappers.h"
+#include "wire.h"
 
+#include <atomic>
 #include <pthread.h>
 #include <string>
 
 class ClientApp {
 public:
-  ClientApp();
-  ~ClientApp() = default;
+  // shardCount > 1 connects straight to the login's home shard; otherwise
+  // the client starts at shard 0 and follows the server's redirect.
+  explicit ClientApp(ClientTransport &transport, int shardCount = 1);
+  ~ClientApp();
   void start();
 
 private:
+  ClientTransport &transport;
   std::string login;
   std::string currentGame;
+  // Set by the listener, which also clears it when switching shards.
+  std::atomic<unsigned int> sessionId;
+  int shardCount;
   bool isRunning;
   bool inGame;
+  // Waiting in the matchmaking queue.
+  bool queued;
+  // Watching someone else's game.
+  bool watching;
   pthread_t listenerThread;
 
+  // Startup handshake: the listener reports whether the transport opened,
+  // handlePacket() reports the S_LOGIN_ACK.
+  enum HandshakeState { HS_CONNECTING, HS_CONNECTED, HS_LOGGED_IN, HS_FAILED };
+  HandshakeState handshake;
+  pthread_mutex_t handshake_mutex;
+  pthread_cond_t handshake_cond;
+
+  static const int LOGIN_TIMEOUT_SEC = 5;
+  // Well inside the server's default idle timeout.
+  static const int HEARTBEAT_INTERVAL_SEC = 15;
+
+  // The listener sends heartbeats while the main thread sends commands.
+  pthread_mutex_t send_mutex;
+
+  // Local copy of the window shown of both boards, kept up to date from
+  // S_BOARD snapshots and S_BOARD_DELTA cell updates.
+  BoardRenderer boards;
+
+  // What the listener has to show for the frames of one receive(), written
+  // out in one go, and whether it ends in a prompt. Guarded by output_mutex,
+  // which /leave takes to hand the screen back.
+  std::string output;
+  bool promptPending;
+  pthread_mutex_t output_mutex;
+
   static void *listenThreadWrapper(void *context);
   void listenLoop();
+  void handlePacket(Packet &pkt);
+  void flushOutput();
+  void setHandshake(HandshakeState state);
+  bool waitHandshake(HandshakeState state, int timeoutSec);
 
   void sendPacket(Packet &pkt);
+  // Logs out of the current server and in on shard, for S_REDIRECT.
+  void switchShard(int shard);
   void showMainMenu();
   void showGameMenu();
 };
\ No newline at end of file
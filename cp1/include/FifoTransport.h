@@ -0,0 +1,93 @@
+#pragma once
+
+#include "Transport.h"
+#include "wrappers.h"
+
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+// Named pipes: clients write to SERVER_PIPE, the server writes to
+// CLIENT_PIPE_PREFIX<login>. Client pipes are watched by the same epoll
+// instance as the server pipe, so backed-up channels are drained on EPOLLOUT
+// and a pipe whose reader is gone is dropped on EPOLLERR.
+class FifoServerTransport : public ServerTransport {
+public:
+  FifoServerTransport();
+  ~FifoServerTransport();
+
+  bool open() override;
+  void close() override;
+  bool poll(int timeoutMs, TransportListener &listener) override;
+  bool connect(const std::string &login) override;
+  void disconnect(const std::string &login) override;
+  void disconnectWhenFlushed(const std::string &login) override;
+  bool send(const std::string &login, const char *frame,
+            size_t frameSize) override;
+  bool sendShared(const std::string &login, const SharedFrame &frame,
+                  size_t maxQueued) override;
+
+private:
+  struct Channel {
+    uint64_t id;
+    std::string login;
+    NamedPipe pipe;
+    std::deque<SharedFrame> outbound;
+    bool writeArmed;
+    // Dropped as soon as outbound is empty.
+    bool closing;
+  };
+
+  std::map<std::string, Channel> channels;
+  std::map<uint64_t, Channel *> channelsById;
+  uint64_t nextChannelId;
+  pthread_mutex_t channel_mutex;
+
+  NamedPipe serverPipe;
+  FrameReader serverReader;
+  // Reused for every drain of the server pipe.
+  std::vector<Packet> inbound;
+  int epollFd;
+
+  static const int MAX_EVENTS = 64;
+  // A full pipe buffer, so one read() can empty a backed-up pipe.
+  static const size_t SERVER_READ_BUFFER = 64 * 1024;
+  static const uint64_t SERVER_PIPE_ID = 0;
+
+  // send() and sendShared(); shared is null for a frame to copy if it has
+  // to wait.
+  bool enqueue(const std::string &login, const char *frame, size_t frameSize,
+               const SharedFrame *shared, size_t maxQueued);
+
+  // Expect channel_mutex to be held.
+  Channel *getChannel(const std::string &login);
+  void dropChannel(const std::string &login);
+  void armWrite(Channel *channel, bool enable);
+  void flush(Channel *channel);
+
+  void handleChannelEvent(uint64_t id, uint32_t events);
+  void drainServerPipe(TransportListener &listener);
+};
+
+class FifoClientTransport : public ClientTransport {
+public:
+  FifoClientTransport();
+
+  bool open(const std::string &login) override;
+  void close() override;
+  bool send(const char *frame, size_t frameSize) override;
+  ssize_t receive(FrameReader &reader) override;
+
+private:
+  NamedPipe inbound;
+  // Kept open for the whole session and reopened once if the server
+  // restarted in between.
+  NamedPipe outbound;
+
+  static const int RECEIVE_WAIT_MS = 100;
+
+  bool openOutbound();
+};
@@ -1,27 +1,116 @@
 #pragma once
 
-#include <cstdlib>
-#include <ctime>
-#include <vector>
+#include "Random.h"
+#include "WideMask.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
 
 enum CellState { EMPTY = 0, SHIP = 1, MISS = 2, HIT = 3 };
 
 enum ShotResult { RES_MISS, RES_HIT, RES_SUNK, RES_REPEAT, RES_LOSE };
 
-class GameBoard {
+// Board variants a room can be created with, see CREATE_GAME.
+// The event mode is played on a SparseBoard, see AnyBoard.h.
+enum BoardMode {
+  MODE_CLASSIC,
+  MODE_LARGE,
+  MODE_HUGE,
+  MODE_EVENT,
+  BOARD_MODES
+};
+
+inline constexpr const char *BOARD_MODE_NAMES[BOARD_MODES] = {
+    "classic", "large", "huge", "event"};
+inline constexpr int BOARD_MODE_SIZES[BOARD_MODES] = {10, 15, 20, 1000};
+
+// Ship lengths of each fleet, longest first.
+struct ClassicFleet {
+  static constexpr int SHIPS[] = {4, 3, 3, 2, 2, 2, 1, 1, 1, 1};
+};
+struct LargeFleet {
+  static constexpr int SHIPS[] = {5, 4, 4, 3, 3, 3, 2, 2, 2, 2, 1, 1, 1, 1};
+};
+struct HugeFleet {
+  static constexpr int SHIPS[] = {6, 5, 5, 4, 4, 4, 3, 3, 3, 3,
+                                  2, 2, 2, 2, 2, 1, 1, 1, 1, 1};
+};
+
+template <size_t N> constexpr int longestShip(const int (&ships)[N]) {
+  int longest = 0;
+  for (int length : ships) {
+    longest = length > longest ? length : longest;
+  }
+  return longest;
+}
+
+// One bit per cell, bit y * SIZE + x. Boards up to 128 cells use a plain
+// integer.
+template <int CELLS>
+using MaskFor = std::conditional_t<CELLS <= 128, unsigned __int128,
+                                   WideMask<(CELLS + 63) / 64>>;
+
+typedef MaskFor<100> BoardMask;
+
+// A ship is stored as its placement; the cells it covers come from a shared
+// table of placement masks.
+struct ShipPlacement {
+  uint16_t origin;
+  uint8_t length;
+  bool horizontal;
+};
+
+// A Size x Size board with the ships of Fleet. Every variant gets its own
+// placement table and loops bounded at compile time; the variants in use are
+// instantiated in GameLogic.cpp.
+template <int Size, typename Fleet> class GameBoard {
 public:
+  static const int SIZE = Size;
+  static const int CELLS = Size * Size;
+  static constexpr auto &FLEET = Fleet::SHIPS;
+  static const int MAX_SHIPS = sizeof(Fleet::SHIPS) / sizeof(int);
+  static const int MAX_SHIP_LENGTH = longestShip(Fleet::SHIPS);
+
+  typedef MaskFor<CELLS> Mask;
+
   GameBoard();
 
-  void placeShipsRandomly();
+  // Places the fleet using only rng, so the same seed always gives the same
+  // board. With noTouching ships do not share an edge or a corner.
+  void placeShips(Xoshiro256 &rng, bool noTouching);
 
   ShotResult processShot(int x, int y);
 
-  int getCell(int x, int y) const { return grid[y][x]; }
+  int getCell(int x, int y) const;
+
+  // Writes SIZE * SIZE CellState values row by row. Without showShips intact
+  // ships are reported as EMPTY.
+  void getSnapshot(char *cells, bool showShips) const;
+
+  // The side x side window with its top-left cell at (left, top), in the
+  // same layout. Cells off the board read as EMPTY.
+  void getViewport(int left, int top, int side, char *cells,
+                   bool showShips) const;
 
-  void getBoardString(char *buffer, bool showShips);
+  // Cells covered by a ship of length placed at origin, 0 if it does not fit
+  // on the board.
+  static Mask placementMask(int origin, int length, bool horizontal);
+
+  // mask grown by one cell in all eight directions.
+  static Mask halo(Mask mask);
 
 private:
-  static const int SIZE = 10;
-  int grid[SIZE][SIZE];
-  int shipsAlive;
-};
\ No newline at end of file
+  Mask ships;
+  Mask hits;
+  Mask misses;
+  ShipPlacement fleet[MAX_SHIPS];
+  uint8_t shipCount;
+
+  void clear();
+  bool tryPlaceFleet(Xoshiro256 &rng, bool noTouching);
+};
+
+typedef GameBoard<BOARD_MODE_SIZES[MODE_CLASSIC], ClassicFleet> ClassicBoard;
+typedef GameBoard<BOARD_MODE_SIZES[MODE_LARGE], LargeFleet> LargeBoard;
+typedef GameBoard<BOARD_MODE_SIZES[MODE_HUGE], HugeFleet> HugeBoard;
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "protocol.h"
+
+#include <pthread.h>
+#include <vector>
+
+// Fixed number of GameSessions, allocated once when the server starts.
+// Handles are indices, so a game is one array access away, and the free list
+// makes both alloc() and release() O(1).
+//
+// Games start under the list write lock but end under the shard mutex of the
+// game, so the free list has a mutex of its own. get() needs none: a session
+// is only touched by the players seated in it.
+class GamePool {
+public:
+  explicit GamePool(int capacity);
+  ~GamePool();
+
+  GamePool(const GamePool &) = delete;
+  GamePool &operator=(const GamePool &) = delete;
+
+  // NO_GAME when every session is in use.
+  int alloc();
+  // Resets the session for its next game.
+  void release(int handle);
+
+  GameSession *get(int handle) {
+    if (handle < 0 || handle >= (int)sessions.size()) {
+      return nullptr;
+    }
+    return &sessions[handle];
+  }
+
+  int capacity() const { return (int)sessions.size(); }
+  int size();
+  bool full() { return size() == capacity(); }
+
+private:
+  std::vector<GameSession> sessions;
+  std::vector<int> freeHandles;
+  pthread_mutex_t mutex;
+};
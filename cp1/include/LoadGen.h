@@ -0,0 +1,115 @@
+#pragma once
+
+#include "Random.h"
+#include "ShotStrategy.h"
+#include "Transport.h"
+#include "protocol.h"
+#include "wire.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+struct LoadGenOptions {
+  std::string transport = "fifo";
+  int bots = 2;
+  int gamesPerPair = 1;
+  // "random", "hunt" or "density".
+  std::string policy = "hunt";
+  uint64_t seed = 1;
+  // Gives up on bots that have not finished by then.
+  int timeoutSec = 60;
+  // Start games through the matchmaking queue instead of named rooms.
+  bool queue = false;
+  // Shard count of the servers. Bots connect to their home shard, and room
+  // pairs get logins that share one.
+  int shards = 1;
+};
+
+// Request types whose round trip is measured.
+enum LatencyKind {
+  LAT_LOGIN,
+  LAT_CREATE,
+  LAT_JOIN,
+  // From QUEUE until the game starts.
+  LAT_QUEUE,
+  LAT_SHOOT,
+  LAT_KINDS
+};
+
+// Drives a fleet of headless clients through the real protocol. Bots are
+// paired up: the first of a pair creates a room, the second joins it, and
+// they play full games with a simple shot policy. Every bot runs on its own
+// thread and records the round trip of each request it makes.
+class LoadGen {
+public:
+  explicit LoadGen(const LoadGenOptions &options);
+
+  // Returns false if a bot failed or the run timed out.
+  bool run();
+
+  // Throughput and latency percentiles of the last run, as JSON.
+  std::string report() const;
+
+private:
+  struct Pair {
+    // Number of rooms the creator has opened so far, the joiner waits for
+    // the next one.
+    std::atomic<int> roomsCreated{0};
+    std::string roomPrefix;
+  };
+
+  struct Bot {
+    LoadGen *gen;
+    int id;
+    Pair *pair;
+    bool creator;
+    std::string login;
+    pthread_t thread;
+    std::unique_ptr<ClientTransport> transport;
+    std::unique_ptr<ShotStrategy> strategy;
+    FrameReader reader;
+    unsigned int sessionId = 0;
+    uint64_t seed = 0;
+
+    // Round trips in nanoseconds.
+    std::vector<uint64_t> latencies[LAT_KINDS];
+    uint64_t moves = 0;
+    int gamesFinished = 0;
+    int errors = 0;
+    std::atomic<bool> done{false};
+    bool ok = false;
+  };
+
+  LoadGenOptions options;
+  std::vector<std::unique_ptr<Pair>> pairs;
+  std::vector<std::unique_ptr<Bot>> bots;
+  double elapsedSec;
+  bool timedOut;
+
+  static void *botThreadWrapper(void *context);
+  bool runBot(Bot &bot);
+  // Creates or joins the pair's room for game; start is the S_GAME_START.
+  bool enterRoom(Bot &bot, int game, Packet &start);
+  // Queues for a match. Gives up, with matched false, once the run has
+  // started all its games.
+  bool waitForMatch(Bot &bot, Packet &start, bool &matched);
+  bool playGame(Bot &bot, int game, const Packet &start);
+
+  bool send(Bot &bot, Packet &pkt);
+  // Waits for the next packet, false once the bot's deadline has passed.
+  bool receive(Bot &bot, Packet &pkt);
+  // Sends pkt and waits for a packet of type expect, recording the round
+  // trip under kind.
+  bool request(Bot &bot, Packet &pkt, int expect, LatencyKind kind);
+  // Moves the bot to the shard an S_REDIRECT names and logs in there.
+  bool follow(Bot &bot, const Packet &redirect);
+
+  uint64_t deadlineNs;
+  int totalGames = 0;
+  // S_GAME_START packets received by all bots, two per game.
+  std::atomic<int> gameStarts{0};
+};
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <pthread.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+enum LogLevel { LOG_DEBUG, LOG_INFO, LOG_WARN, LOG_ERROR };
+
+// What a record describes; the logger thread turns each event into its line.
+enum LogEvent {
+  EV_LOGIN,
+  EV_LOGIN_REJECTED,
+  EV_LOGOUT,
+  EV_GAME_CREATED,
+  EV_GAME_JOINED,
+  EV_GAME_CANCELLED,
+  EV_GAME_START,
+  EV_SHOT,
+  EV_GAME_OVER,
+  EV_SHOT_REJECTED,
+  EV_QUEUED,
+  EV_TURN_TIMEOUT,
+  EV_IDLE_TIMEOUT,
+  EV_REDIRECTED,
+  EV_COUNT
+};
+
+// Why a shot was ignored, for EV_SHOT_REJECTED.
+enum ShotRejection {
+  REJECT_NO_SHOOTER,
+  REJECT_NOT_IN_GAME,
+  REJECT_NO_OPPONENT,
+  REJECT_NO_VICTIM
+};
+
+// Fixed-size binary record. Names are truncated copies, nothing is formatted
+// on the calling thread.
+struct LogRecord {
+  static const size_t NAME_SIZE = 32;
+
+  uint64_t timeNs;
+  uint8_t level;
+  uint8_t event;
+  int32_t x;
+  int32_t y;
+  uint64_t value;
+  char player[NAME_SIZE];
+  char other[NAME_SIZE];
+  char game[NAME_SIZE];
+};
+
+// Asynchronous logger. Every thread appends records to its own
+// single-producer ring without locks or syscalls; a background thread drains
+// all rings, orders the batch by time and writes it to stdout with one
+// write(). When a ring is full the record is dropped and counted rather than
+// blocking the caller.
+class Logger {
+public:
+  Logger();
+  ~Logger();
+
+  void setLevel(LogLevel level) { minLevel = level; }
+  // Keeps one in every n records of events logged with sampled = true.
+  void setSampling(int n) { sampleEvery = n > 1 ? n : 1; }
+
+  void start();
+  // Writes out everything still queued, then stops the thread.
+  void stop();
+
+  void log(LogLevel level, LogEvent event, std::string_view player,
+           std::string_view other = {}, std::string_view game = {},
+           int x = 0, int y = 0, uint64_t value = 0, bool sampled = false);
+
+private:
+  struct Ring {
+    static const uint32_t CAPACITY = 1024;
+
+    alignas(64) std::atomic<uint32_t> head;
+    alignas(64) std::atomic<uint32_t> tail;
+    // Only touched by the producer.
+    alignas(64) uint32_t sampleCounter;
+    std::atomic<uint64_t> dropped;
+    LogRecord records[CAPACITY];
+
+    Ring() : head(0), tail(0), sampleCounter(0), dropped(0) {}
+  };
+
+  std::vector<Ring *> rings;
+  pthread_mutex_t rings_mutex;
+  LogLevel minLevel;
+  int sampleEvery;
+
+  pthread_t thread;
+  bool running;
+  pthread_mutex_t wake_mutex;
+  pthread_cond_t wake_cond;
+
+  static const int FLUSH_INTERVAL_MS = 20;
+
+  static thread_local Logger *cachedOwner;
+  static thread_local Ring *cached;
+
+  Ring *threadRing() {
+    if (cachedOwner != this) {
+      cached = registerThread();
+      cachedOwner = this;
+    }
+    return cached;
+  }
+  Ring *registerThread();
+  static void *threadWrapper(void *context);
+  void writerLoop();
+  // Moves every queued record out of the rings and writes them.
+  void drain(std::vector<LogRecord> &batch, std::string &out);
+};
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// A player waiting for an automatic match. The ticket tells a stale entry
+// (the player left the queue or logged out since) from a live one.
+struct QueueEntry {
+  int handle;
+  unsigned int sessionId;
+  unsigned int ticket;
+  int rating;
+  uint64_t enqueuedNs;
+};
+
+// Matchmaking queue. Workers push with a single compare-and-swap onto a
+// lock-free stack; the matcher thread takes the whole stack at once and keeps
+// the players it could not pair yet in a list only it touches.
+class Matchmaker {
+public:
+  Matchmaker();
+  ~Matchmaker();
+
+  void push(const QueueEntry &entry);
+
+  // Moves everything pushed since the last call to the end of waiting, in
+  // arrival order.
+  void takeAll(std::vector<QueueEntry> &waiting);
+
+  // Pairs waiting players and removes them from waiting. With rated, players
+  // are paired with the closest rating within a window that widens the
+  // longer they wait; otherwise in arrival order.
+  static void pair(std::vector<QueueEntry> &waiting, bool rated,
+                   uint64_t nowNs,
+                   std::vector<std::pair<QueueEntry, QueueEntry>> &pairs);
+
+private:
+  struct Node {
+    QueueEntry entry;
+    Node *next;
+  };
+
+  std::atomic<Node *> top;
+
+  static const int BASE_RATING_WINDOW = 100;
+  // Window growth per second of waiting; ratings run from 0 to 1000, so
+  // within ten seconds anyone matches.
+  static const int RATING_WINDOW_PER_SEC = 100;
+};
@@ -0,0 +1,167 @@
+#pragma once
+
+#include "protocol.h"
+
+#include <atomic>
+#include <cstdint>
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+// Log-linear latency histogram in the style of HdrHistogram: values below 16
+// get a bucket each, above that every power of two is split into 16 buckets,
+// so any recorded value is known to within 1/16 (6%).
+//
+// Only the owning thread records, with plain relaxed load/store pairs instead
+// of read-modify-write instructions; readers may see a slightly stale count
+// but never a torn one.
+class Histogram {
+public:
+  static const int SUB_BITS = 4;
+  static const int SUB_COUNT = 1 << SUB_BITS;
+  static const int BUCKETS = (64 - SUB_BITS + 1) * SUB_COUNT;
+
+  Histogram();
+
+  void record(uint64_t value) {
+    bump(buckets[bucketOf(value)], 1);
+    bump(total, value);
+    if (value > max.load(std::memory_order_relaxed)) {
+      max.store(value, std::memory_order_relaxed);
+    }
+  }
+
+  // Adds this histogram's buckets to counts (BUCKETS entries).
+  void collect(std::vector<uint64_t> &counts, uint64_t &sum,
+               uint64_t &maxValue) const;
+
+  static int bucketOf(uint64_t value) {
+    if (value < (uint64_t)SUB_COUNT) {
+      return (int)value;
+    }
+    int shift = 63 - __builtin_clzll(value) - SUB_BITS;
+    return (shift + 1) * SUB_COUNT + (int)((value >> shift) & (SUB_COUNT - 1));
+  }
+
+  // Largest value that falls into bucket.
+  static uint64_t bucketLimit(int bucket);
+
+private:
+  std::atomic<uint64_t> buckets[BUCKETS];
+  std::atomic<uint64_t> total;
+  std::atomic<uint64_t> max;
+
+  static void bump(std::atomic<uint64_t> &cell, uint64_t delta) {
+    cell.store(cell.load(std::memory_order_relaxed) + delta,
+               std::memory_order_relaxed);
+  }
+};
+
+enum MetricCounter {
+  CNT_PACKETS_IN,
+  CNT_PACKETS_REJECTED,
+  CNT_FRAMES_OUT,
+  CNT_SEND_FAILURES,
+  CNT_GAMES_STARTED,
+  CNT_GAMES_FINISHED,
+  CNT_TURN_TIMEOUTS,
+  CNT_IDLE_TIMEOUTS,
+  // Wakeups that handed packets to the workers, and list_lock acquisitions;
+  // both against packets_in show how well bursts are batched.
+  CNT_INBOUND_BATCHES,
+  CNT_LIST_LOCKS,
+  // Spectators cut off for falling too far behind their game.
+  CNT_SPECTATORS_DROPPED,
+  CNT_COUNT
+};
+
+enum MetricGauge {
+  GAUGE_PLAYERS_ONLINE,
+  GAUGE_ACTIVE_GAMES,
+  GAUGE_OPEN_ROOMS,
+  GAUGE_LOBBY_SIZE,
+  GAUGE_INBOUND_BACKLOG,
+  GAUGE_MATCH_QUEUE,
+  GAUGE_ARMED_TIMERS,
+  GAUGE_SPECTATORS,
+  GAUGE_COUNT
+};
+
+// Server metrics. Counters and histograms are kept per thread and summed on
+// read, so recording never contends; gauges are single shared values.
+class Metrics {
+public:
+  Metrics();
+  ~Metrics();
+
+  static uint64_t nowNs();
+
+  void count(MetricCounter counter, uint64_t delta = 1) {
+    ThreadMetrics *local = threadLocal();
+    local->counters[counter].store(
+        local->counters[counter].load(std::memory_order_relaxed) + delta,
+        std::memory_order_relaxed);
+  }
+
+  // Time spent handling one packet of the given type.
+  void recordHandler(int type, uint64_t ns) {
+    if (type >= 0 && type < MSG_TYPE_COUNT) {
+      threadLocal()->handlers[type].record(ns);
+    }
+  }
+
+  // Time a packet waited in a worker queue.
+  void recordQueueWait(uint64_t ns) { threadLocal()->queueWait.record(ns); }
+
+  void setGauge(MetricGauge gauge, int64_t value) {
+    gauges[gauge].store(value, std::memory_order_relaxed);
+  }
+  void addGauge(MetricGauge gauge, int64_t delta) {
+    gauges[gauge].fetch_add(delta, std::memory_order_relaxed);
+  }
+
+  // Plain text, one metric per line.
+  std::string snapshot();
+
+  // Rewrites path with a snapshot every intervalSec seconds until
+  // stopDumper().
+  void startDumper(const std::string &path, int intervalSec);
+  void stopDumper();
+
+private:
+  struct ThreadMetrics {
+    std::atomic<uint64_t> counters[CNT_COUNT];
+    Histogram handlers[MSG_TYPE_COUNT];
+    Histogram queueWait;
+
+    ThreadMetrics();
+  };
+
+  std::vector<ThreadMetrics *> threads;
+  pthread_mutex_t threads_mutex;
+  std::atomic<int64_t> gauges[GAUGE_COUNT];
+  uint64_t startNs;
+
+  std::string dumpPath;
+  int dumpIntervalSec;
+  bool dumperRunning;
+  pthread_t dumper;
+  pthread_mutex_t dump_mutex;
+  pthread_cond_t dump_cond;
+
+  // Each thread registers its block on first use and caches the pointer.
+  static thread_local Metrics *cachedOwner;
+  static thread_local ThreadMetrics *cached;
+
+  ThreadMetrics *threadLocal() {
+    if (cachedOwner != this) {
+      cached = registerThread();
+      cachedOwner = this;
+    }
+    return cached;
+  }
+  ThreadMetrics *registerThread();
+  static void *dumperThreadWrapper(void *context);
+  void dumpLoop();
+  void writeDump();
+};
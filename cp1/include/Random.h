@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+
+// xoshiro256** (Blackman, Vigna). Small, fast and, unlike std::rand(), owned
+// by the caller, so every game draws from its own stream and replays exactly
+// from its seed. Not for anything security related.
+class Xoshiro256 {
+public:
+  explicit Xoshiro256(uint64_t seed) {
+    // The state is expanded with splitmix64, which never yields the all-zero
+    // state xoshiro cannot leave.
+    for (uint64_t &word : s) {
+      seed += 0x9e3779b97f4a7c15ull;
+      uint64_t z = seed;
+      z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+      z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+      word = z ^ (z >> 31);
+    }
+  }
+
+  uint64_t next() {
+    uint64_t result = rotl(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 45);
+    return result;
+  }
+
+  // Uniform in [0, bound), bound > 0. Lemire's multiply-shift; the bias for
+  // the small bounds used here is far below anything observable.
+  uint32_t below(uint32_t bound) {
+    return (uint32_t)(((next() >> 32) * (uint64_t)bound) >> 32);
+  }
+
+private:
+  uint64_t s[4];
+
+  static uint64_t rotl(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+};
@@ -1,42 +1,252 @@
 #pragma once
 
+#include "GamePool.h"
+#include "Logger.h"
+#include "Matchmaker.h"
+#include "Metrics.h"
+#include "Random.h"
+#include "ShardDirectory.h"
+#include "Slab.h"
+#include "SpectatorHub.h"
+#include "StatsStore.h"
+#include "TimerWheel.h"
+#include "Transport.h"
 #include "protocol.h"
-#include "wrappers.h"
+#include "wire.h"
 
+#include <cstdint>
 #include <pthread.h>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include <map>
 
-class ServerApp {
+class ServerApp;
+
+struct ServerOptions {
+  std::string transport = "fifo";
+  // Seeds the generator that hands every game its own placement seed.
+  uint64_t seed = 0;
+  bool noTouching = true;
+  // Statistics live in <statsPath>.dat and <statsPath>.log.
+  std::string statsPath = "battleship_stats";
+  // Metrics are rewritten to metricsFile every metricsIntervalSec seconds,
+  // 0 disables the dump.
+  std::string metricsFile = "battleship_metrics.txt";
+  int metricsIntervalSec = 10;
+  LogLevel logLevel = LOG_INFO;
+  // Only one in logSample shots is logged.
+  int logSample = 1;
+  // Pair queued players by rating rather than in arrival order.
+  bool ratedMatching = true;
+  // A player who lets turnTimeoutSec pass without shooting loses the game,
+  // a client silent for idleTimeoutSec is logged out. 0 disables either.
+  int turnTimeoutSec = 60;
+  int idleTimeoutSec = 60;
+  // This server is shard shardIndex of shardCount. Every shard needs its own
+  // statsPath; logins are spread over the shards by loginShard().
+  int shardCount = 1;
+  int shardIndex = 0;
+  // Size of the GamePool; players are turned away once every session is in
+  // use.
+  int maxGames = 4096;
+  // The only login that may read the metrics through ADMIN_METRICS; with
+  // none set, nobody can.
+  std::string adminLogin;
+};
+
+struct QueuedPacket {
+  Packet pkt;
+  uint64_t queuedNs;
+};
+
+struct Worker {
+  ServerApp *app;
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  // Taken as a whole by the worker, which swaps in its emptied batch.
+  std::vector<QueuedPacket> queue;
+};
+
+class ServerApp : public TransportListener {
 public:
-  ServerApp();
+  ServerApp(ServerTransport &transport, const ServerOptions &options);
   ~ServerApp();
   void run();
 
+  void onPackets(std::vector<Packet> &packets) override;
+
 private:
-  std::vector<Player> players;
-  std::vector<GameRoom> gameRooms;
-  std::map<std::string, PlayerStats> playerStats;
-  pthread_mutex_t list_mutex;
-  NamedPipe serverPipe;
+  Slab<Player> players;
+  Slab<GameRoom> gameRooms;
+  GamePool games;
+  // Keys view the login/name stored in the slab entry itself.
+  std::unordered_map<std::string_view, int> playerIndex;
+  std::unordered_map<std::string_view, int> roomIndex;
+
+  // Players that have fetched the game list and get S_ROOM_ADDED /
+  // S_ROOM_REMOVED deltas until they enter a game or log out.
+  std::unordered_set<int> lobbySubscribers;
+  // Pre-encoded S_GAME_LIST frames, rebuilt only after a room changed.
+  std::vector<std::string> gameListPages;
+  bool gameListDirty;
+  StatsStore stats;
+  Metrics metrics;
+  Logger logger;
+  std::vector<Worker> workers;
+  // Per-worker staging for routePackets(), only used by the event loop.
+  std::vector<std::vector<QueuedPacket>> routed;
+
+  // Lobby state (player list, rooms, lobby fields of players) is shared by
+  // all workers; in-game fields are guarded by the shard of the game.
+  pthread_rwlock_t list_lock;
+  pthread_mutex_t shard_mutexes[NUM_GAME_SHARDS];
+
+  ServerTransport &transport;
   bool isRunning;
 
-  Player *findPlayer(const std::string &login);
-  GameRoom *findGameRoom(const std::string &gameName);
-  PlayerStats *getPlayerStats(const std::string &login);
+  // Spectators of running games, fed by the shots and results of the game.
+  SpectatorHub spectators;
+
+  static const size_t GAME_LIST_PAGE_BYTES = 384;
+  // Packets handled under one list_lock acquisition at most, so a long
+  // batch does not starve the other workers.
+  static const size_t MAX_LOCKED_BATCH = 32;
+
+  // A session id is the player's slab handle tagged with a generation, so a
+  // stale id from a previous owner of the slot is rejected.
+  static const int SESSION_HANDLE_BITS = 22;
+  static const unsigned int SESSION_HANDLE_MASK = (1u << SESSION_HANDLE_BITS) - 1;
+  unsigned int nextSessionGeneration;
+
+  ServerOptions options;
+  // Draws the per-game placement seeds, guarded by list_lock.
+  Xoshiro256 seedSource;
+
+  // Players queued for an automatic match; the matcher thread pairs them
+  // every MATCH_INTERVAL_MS.
+  Matchmaker matchmaker;
+  pthread_t matcher;
+  bool matcherRunning;
+  pthread_mutex_t matcher_mutex;
+  pthread_cond_t matcher_cond;
+  // Guarded by list_lock.
+  unsigned int nextQueueTicket;
+  unsigned int nextMatchId;
+
+  static const int MATCH_INTERVAL_MS = 20;
+
+  // Turn and idle timers. Workers arm and cancel them, the event loop
+  // advances the wheel and routes every expiry to the player's worker as a
+  // TIMER_EXPIRED packet.
+  enum TimerKind { TIMER_TURN, TIMER_IDLE };
+  TimerWheel timers;
+  pthread_mutex_t timer_mutex;
+  std::vector<TimerWheel::Expired> expiredTimers;
+  std::vector<Packet> expiredPackets;
+
+  static const int TIMER_TICK_MS = 100;
+
+  // Sharded deployments only. A queued player left alone for
+  // CROSS_SHARD_WAIT_NS is offered to the other shards through the
+  // directory; a shard that claims an offer hosts the game and waits up to
+  // GUEST_WAIT_NS for the guest to log in.
+  struct PendingGuest {
+    int hostHandle;
+    unsigned int hostSession;
+    unsigned int hostTicket;
+    int hostRating;
+    std::string gameName;
+    uint64_t expiresNs;
+  };
+  ShardDirectory directory;
+  // Keyed by guest login, guarded by list_lock.
+  std::unordered_map<std::string, PendingGuest> pendingGuests;
+
+  static const uint64_t CROSS_SHARD_WAIT_NS = 500000000ull;
+  static const uint64_t GUEST_WAIT_NS = 5000000000ull;
+
+  Player *findPlayer(std::string_view login);
+  GameRoom *findGameRoom(std::string_view gameName);
+  void removeGameRoom(std::string_view gameName);
+  bool resolveSender(Packet &pkt);
+
+  void startWorkers();
+  void stopWorkers();
+  static void *workerThreadWrapper(void *context);
+  void workerLoop(Worker &worker);
+  void startMatcher();
+  void stopMatcher();
+  static void *matcherThreadWrapper(void *context);
+  void matcherLoop();
+  void matchPlayers(std::vector<QueueEntry> &waiting);
+  // Expect list_lock and the directory lock to be held.
+  void takeClaimedOffers(std::vector<QueueEntry> &waiting);
+  void offerAcrossShards(std::vector<QueueEntry> &waiting, uint64_t nowNs);
+  // Expect list_lock to be held.
+  void expireGuests(uint64_t nowNs);
+  void startGuestGame(Player *guest, const PendingGuest &pending);
+  bool redirectGuestHome(Packet &pkt);
+  void sendRedirect(const std::string &login, int shard, RedirectReason reason,
+                    const char *message);
+  // Redirects a guest to its home shard and marks it sentHome.
+  void sendHome(Player *guest, const char *message);
+  void recordResult(Player *player, bool won, uint32_t shots, uint32_t hits);
+  void deliverMail(std::vector<StatsRecord> &deltas);
+  void routePackets(std::vector<Packet> &packets);
+  static bool needsExclusiveLock(int type);
+  void processBatch(std::vector<QueuedPacket> &batch);
+  // Expects list_lock to be held in the mode needsExclusiveLock() asks for.
+  void processPacket(Packet &pkt);
+  void dispatchPacket(Packet &pkt);
+
   void sendToClient(const std::string &login, Packet &pkt);
-  void sendBoard(Player *pTarget, GameBoard &boardOwner, bool showShips,
-                 const char *title);
-  void updateStatsAfterGame(const std::string &winner, const std::string &loser);
-  void sendGameList(const std::string &login);
+  void sendFrame(const std::string &login, const char *frame, size_t frameSize);
+  // Sends the window of board with its top-left cell at (left, top), moved
+  // back onto the board where needed.
+  void sendBoardSnapshot(const std::string &login, const AnyBoard &board,
+                         bool showShips, BoardId boardId, int left, int top);
+  void sendCellUpdate(const std::string &login, BoardId boardId, int x, int y,
+                      const AnyBoard &board);
+  void sendBoards(Player *player, int left = 0, int top = 0);
+  void updateStatsAfterGame(const GameSession &game, int winnerSeat);
+  void broadcastLobby(Packet &pkt);
+  void rebuildGameListPages();
+  void sendGameList(const std::string &login, int page);
 
   void handleLogin(Packet &pkt);
   void handleCreateGame(Packet &pkt);
   void handleJoinGame(Packet &pkt);
   void handleLeaveGame(Packet &pkt);
   void handleShoot(Packet &pkt);
+  void resolveShot(Player *shooter, Packet &pkt);
   void handleLogout(Packet &pkt);
   void handleGetStats(Packet &pkt);
-  void startGame(GameRoom &room);
+  void handleGetBoard(Packet &pkt);
+  void handleAdminMetrics(Packet &pkt);
+  void handleQueue(Packet &pkt);
+  void handleSpectate(Packet &pkt);
+  void leaveQueue(Player *player);
+  // Expects a free session, see GamePool::full().
+  void startGame(Player *player1, Player *player2, const std::string &name,
+                 BoardMode mode = MODE_CLASSIC);
+  // Detaches both players, records the result and recycles the session.
+  // Expect list_lock for writing or the game's shard mutex to be held.
+  void endGame(GameSession *game, int winnerSeat);
+  // Ends the player's game in favour of the opponent, who is sent message.
+  void forfeitGame(Player *player, const char *message);
+
+  static uint64_t nowMs();
+  // Replaces the timer in slot, if any, with a new one.
+  void armTimer(uint64_t &slot, TimerKind kind, Player *player,
+                uint64_t delayMs);
+  void cancelTimer(uint64_t &slot);
+  void armTurnTimer(GameSession *game);
+  void expireTimers();
+  void handleTimerExpired(Packet &pkt);
+  void handleTurnTimeout(Player *player);
+  void handleIdleTimeout(Player *player);
 };
\ No newline at end of file
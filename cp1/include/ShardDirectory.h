@@ -0,0 +1,94 @@
+#pragma once
+
+#include "StatsStore.h"
+#include "Transport.h"
+
+#include <atomic>
+#include <cstdint>
+#include <pthread.h>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+#define SHARD_DIRECTORY_SEGMENT "/battleship_directory"
+
+// A queued player that its home shard could not pair, offered to the other
+// shards. Another shard claims it for one of its own waiting players and
+// hosts the game; the home shard then redirects the player there.
+struct ShardOffer {
+  char login[32];
+  int32_t homeShard;
+  uint32_t ticket;
+  int32_t rating;
+  uint64_t postedNs;
+  int32_t state;
+  int32_t hostShard;
+};
+
+// Shared-memory directory of a sharded deployment. The first server to start
+// creates it and later ones attach; it outlives the servers, so offers and
+// mail of a restarted shard are picked up where they were left.
+//
+// It holds the pid of every shard, the offers of the cross-shard match queue
+// and a mailbox per shard. A game with a guest records the guest's result in
+// a stats delta that is mailed to the guest's home shard, so every player's
+// statistics stay in one StatsStore.
+//
+// One robust process-shared mutex guards everything; it is only taken by the
+// matcher threads, once per tick, and when a guest's game ends.
+class ShardDirectory {
+public:
+  ShardDirectory();
+  ~ShardDirectory();
+
+  bool open(int shardCount, int shard);
+  void close();
+
+  void lock();
+  void unlock();
+
+  // Expect the lock to be held.
+
+  // Offers of this shard that another shard claimed since the last call.
+  // They are removed from the directory.
+  void takeClaimed(std::vector<ShardOffer> &claimed);
+  // Offers the player, unless an offer with this ticket is up already.
+  // False if the directory is full.
+  bool post(const std::string &login, uint32_t ticket, int rating,
+            uint64_t nowNs);
+  // Withdraws the offer with this ticket, if it is still unclaimed.
+  void withdraw(uint32_t ticket);
+  // Claims the open offer of another live shard that fits rating best, or
+  // the oldest one when rated is false.
+  bool claim(int rating, bool rated, ShardOffer &claimed);
+
+  // Takes the lock itself. False if the shard's mailbox is full.
+  bool mail(int shard, const StatsRecord &delta);
+  void takeMail(std::vector<StatsRecord> &deltas);
+
+private:
+  static const int MAX_OFFERS = 256;
+  static const uint32_t MAILBOX_SIZE = 128;
+
+  enum OfferState { OFFER_FREE = 0, OFFER_OPEN, OFFER_CLAIMED };
+
+  struct Mailbox {
+    uint32_t head;
+    uint32_t tail;
+    StatsRecord deltas[MAILBOX_SIZE];
+  };
+
+  struct Segment {
+    std::atomic<uint32_t> magic;
+    int32_t shardCount;
+    pthread_mutex_t mutex;
+    pid_t pids[MAX_SHARDS];
+    ShardOffer offers[MAX_OFFERS];
+    Mailbox mailboxes[MAX_SHARDS];
+  };
+
+  Segment *segment;
+  int shard;
+
+  bool isAlive(int other);
+};
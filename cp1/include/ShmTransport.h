@@ -0,0 +1,117 @@
+#pragma once
+
+#include "Transport.h"
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <pthread.h>
+#include <string>
+
+#define SHM_SERVER_SEGMENT "/battleship_server"
+#define SHM_CLIENT_SEGMENT_PREFIX "/battleship_client_"
+
+// Single-producer single-consumer byte ring living in shared memory. head and
+// tail are free-running byte positions, each on its own cache line so the two
+// sides never write to the same line. A frame is only pushed when it fits as a
+// whole, so the consumer never sees a partial frame followed by another
+// producer's bytes.
+struct ShmRing {
+  static const uint32_t SIZE = 64 * 1024;
+  static const uint32_t MASK = SIZE - 1;
+
+  alignas(64) std::atomic<uint32_t> head;
+  alignas(64) std::atomic<uint32_t> tail;
+  // Set by a consumer that is about to sleep on tail.
+  alignas(64) std::atomic<uint32_t> waiting;
+  alignas(64) char data[SIZE];
+};
+
+// One per client, created by the client: a ring in each direction.
+struct ShmClientSegment {
+  std::atomic<uint32_t> magic;
+  pid_t pid;
+  ShmRing toServer;
+  ShmRing toClient;
+};
+
+// Created by the server. Clients announce their segment by appending their
+// login to pending and ringing the doorbell; the server sleeps on doorbell
+// whenever every client ring is empty.
+struct ShmServerSegment {
+  static const int MAX_PENDING = 64;
+
+  std::atomic<uint32_t> magic;
+  pthread_mutex_t mutex;
+  int pendingCount;
+  char pending[MAX_PENDING][sizeof(Packet::sender)];
+
+  alignas(64) std::atomic<uint32_t> doorbell;
+  std::atomic<uint32_t> sleeping;
+};
+
+// Shared-memory rings with futex wakeups. Nothing is copied through the
+// kernel: a frame is encoded straight into the peer's ring, and a syscall is
+// only made to wake a side that has gone to sleep on an empty ring.
+class ShmServerTransport : public ServerTransport {
+public:
+  ShmServerTransport();
+  ~ShmServerTransport();
+
+  bool open() override;
+  void close() override;
+  bool poll(int timeoutMs, TransportListener &listener) override;
+  bool connect(const std::string &login) override;
+  void disconnect(const std::string &login) override;
+  void disconnectWhenFlushed(const std::string &login) override;
+  bool send(const std::string &login, const char *frame,
+            size_t frameSize) override;
+  bool sendShared(const std::string &login, const SharedFrame &frame,
+                  size_t maxQueued) override;
+
+private:
+  struct Client {
+    ShmClientSegment *segment;
+    FrameReader reader;
+    std::deque<SharedFrame> outbound;
+    // Dropped as soon as outbound is empty.
+    bool closing = false;
+  };
+
+  std::string segmentName;
+  ShmServerSegment *segment;
+  std::map<std::string, Client> clients;
+  pthread_mutex_t clients_mutex;
+
+  // How often frames queued for a client with a full ring are retried.
+  static const int RETRY_INTERVAL_MS = 10;
+
+  // send() and sendShared(); shared is null for a frame to copy if it has
+  // to wait.
+  bool enqueue(const std::string &login, const char *frame, size_t frameSize,
+               const SharedFrame *shared, size_t maxQueued);
+
+  // Expect clients_mutex to be held.
+  void acceptRegistrations();
+  void dropClient(const std::string &login);
+  void flush(const std::string &login, Client &client);
+};
+
+class ShmClientTransport : public ClientTransport {
+public:
+  ShmClientTransport();
+  ~ShmClientTransport();
+
+  bool open(const std::string &login) override;
+  void close() override;
+  bool send(const char *frame, size_t frameSize) override;
+  ssize_t receive(FrameReader &reader) override;
+
+private:
+  std::string segmentName;
+  ShmClientSegment *segment;
+  ShmServerSegment *server;
+
+  static const int RECEIVE_WAIT_MS = 100;
+};
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "GameLogic.h"
+#include "Random.h"
+
+#include <string>
+
+// Picks the cells a bot shoots at. One instance plays one game at a time and
+// is reused through reset(), so a game never allocates.
+//
+// The base class tracks what the shooter has learnt: cells tried, hits that
+// do not belong to a sunk ship yet, and which ships are still afloat. With
+// noTouching the cells around a sunk ship are known to be empty and are not
+// offered again; if the opponent's fleet does in fact touch, next() still
+// falls back to any untried cell, so a game always finishes.
+class ShotStrategy {
+public:
+  static const int CELLS = ClassicBoard::SIZE * ClassicBoard::SIZE;
+
+  virtual ~ShotStrategy() {}
+
+  virtual void reset(Xoshiro256 &rng, bool noTouching);
+  // Cell index y * SIZE + x of the next shot.
+  virtual int next(Xoshiro256 &rng) = 0;
+  virtual void onResult(int cell, ShotResult result);
+
+protected:
+  bool noTouching;
+  BoardMask tried;
+  BoardMask openHits;
+  // Empty for certain: shot at, or next to a sunk ship.
+  BoardMask excluded;
+  // Ships still afloat, by length.
+  int afloat[ClassicBoard::MAX_SHIP_LENGTH + 1];
+
+  // Any untried cell, for when a strategy has run out of ideas.
+  int anyUntried() const;
+  // Picks one set bit of mask uniformly, mask != 0.
+  static int pickBit(BoardMask mask, Xoshiro256 &rng);
+
+private:
+  void markSunk(int cell);
+};
+
+// Shoots untried cells in a random order and ignores the results.
+class RandomStrategy : public ShotStrategy {
+public:
+  void reset(Xoshiro256 &rng, bool noTouching) override;
+  int next(Xoshiro256 &rng) override;
+
+private:
+  int order[CELLS];
+  int nextIndex;
+};
+
+// Hunts on random cells of a checkerboard; after a hit it targets the
+// neighbours, along the line once two hits are adjacent, until the ship
+// sinks.
+class HuntTargetStrategy : public ShotStrategy {
+public:
+  int next(Xoshiro256 &rng) override;
+};
+
+// For every cell, counts how many placements of the ships still afloat would
+// cover it given everything seen so far, and shoots the most likely one.
+// Placements through an unresolved hit weigh far more, which turns the hunt
+// into a target search without a separate mode.
+class DensityStrategy : public ShotStrategy {
+public:
+  int next(Xoshiro256 &rng) override;
+
+private:
+  static const int HIT_WEIGHT = 50;
+};
+
+// "random", "hunt" or "density"; nullptr for anything else.
+ShotStrategy *createShotStrategy(const std::string &name);
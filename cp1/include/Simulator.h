@@ -0,0 +1,70 @@
+#pragma once
+
+#include "GameLogic.h"
+
+#include <atomic>
+#include <cstdint>
+#include <pthread.h>
+#include <string>
+
+struct SimulatorOptions {
+  uint64_t games = 100000;
+  // 0 uses every online core.
+  int threads = 0;
+  // Strategy of each side: "random", "hunt" or "density".
+  std::string strategyA = "density";
+  std::string strategyB = "hunt";
+  uint64_t seed = 1;
+  bool noTouching = true;
+};
+
+// Plays bot-vs-bot games straight on GameBoard, without a server. Game i is
+// played from seed + i whichever thread runs it, so results do not depend on
+// the thread count. Sides take turns starting with A on even games; a hit
+// keeps the turn, as on the server.
+class Simulator {
+public:
+  explicit Simulator(const SimulatorOptions &options);
+
+  // False if a strategy name is unknown.
+  bool run();
+
+  // Throughput and outcome statistics of the last run, as JSON.
+  std::string report() const;
+
+private:
+  // Winners never need more shots than there are cells.
+  static const int MAX_SHOTS = ClassicBoard::SIZE * ClassicBoard::SIZE;
+  // Games a thread claims at a time.
+  static const uint64_t BATCH = 4096;
+
+  struct SideStats {
+    uint64_t wins = 0;
+    uint64_t shots = 0;
+    uint64_t hits = 0;
+    // Games won, by the number of shots the winner fired.
+    uint64_t shotsToWin[MAX_SHOTS + 1] = {};
+
+    void merge(const SideStats &other);
+  };
+
+  struct Totals {
+    uint64_t games = 0;
+    SideStats sides[2];
+  };
+
+  struct Thread {
+    Simulator *sim;
+    pthread_t thread;
+    Totals totals;
+  };
+
+  SimulatorOptions options;
+  int threadCount;
+  double elapsedSec;
+  Totals totals;
+  std::atomic<uint64_t> nextGame;
+
+  static void *threadWrapper(void *context);
+  void runThread(Totals &local);
+};
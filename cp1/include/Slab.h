@@ -0,0 +1,70 @@
+#pragma once
+
+#include <vector>
+
+// Pool of T addressed by integer handles. Storage grows in fixed chunks that
+// never move, so both handles and pointers stay valid until release().
+template <typename T, int CHUNK_SIZE = 64> class Slab {
+public:
+  Slab() : liveCount(0) {}
+  ~Slab() {
+    for (T *chunk : chunks) {
+      delete[] chunk;
+    }
+  }
+
+  Slab(const Slab &) = delete;
+  Slab &operator=(const Slab &) = delete;
+
+  int alloc() {
+    int handle;
+    if (!freeHandles.empty()) {
+      handle = freeHandles.back();
+      freeHandles.pop_back();
+    } else {
+      handle = capacity();
+      if (handle % CHUNK_SIZE == 0) {
+        chunks.push_back(new T[CHUNK_SIZE]);
+      }
+      live.push_back(false);
+    }
+    live[handle] = true;
+    liveCount++;
+    return handle;
+  }
+
+  void release(int handle) {
+    T *item = get(handle);
+    if (!item) {
+      return;
+    }
+    *item = T();
+    live[handle] = false;
+    freeHandles.push_back(handle);
+    liveCount--;
+  }
+
+  T *get(int handle) {
+    if (handle < 0 || handle >= capacity() || !live[handle]) {
+      return nullptr;
+    }
+    return &chunks[handle / CHUNK_SIZE][handle % CHUNK_SIZE];
+  }
+
+  int capacity() const { return (int)live.size(); }
+  int size() const { return liveCount; }
+
+  template <typename Fn> void forEach(Fn fn) {
+    for (int handle = 0; handle < capacity(); ++handle) {
+      if (live[handle]) {
+        fn(chunks[handle / CHUNK_SIZE][handle % CHUNK_SIZE]);
+      }
+    }
+  }
+
+private:
+  std::vector<T *> chunks;
+  std::vector<bool> live;
+  std::vector<int> freeHandles;
+  int liveCount;
+};
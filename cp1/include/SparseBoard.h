@@ -0,0 +1,56 @@
+#pragma once
+
+#include "CellHash.h"
+#include "GameLogic.h"
+
+#include <cstdint>
+#include <vector>
+
+// A board of any size up to MAX_SIZE that stores only what is on it: the
+// ships, indexed by cell in a hash, and the shots as a hash set. Memory and
+// the cost of a shot grow with the fleet and the shots fired, not with the
+// area, so a 1000x1000 sea costs about as much as its ships.
+class SparseBoard {
+public:
+  // Coordinates travel as int16 on the wire.
+  static const int MAX_SIZE = 32767;
+
+  // The fleet is copies times the count ship lengths.
+  SparseBoard(int size, const int *lengths, int count, int copies = 1);
+
+  int size() const { return boardSize; }
+
+  // Same contract as GameBoard::placeShips.
+  void placeShips(Xoshiro256 &rng, bool noTouching);
+
+  ShotResult processShot(int x, int y);
+
+  int getCell(int x, int y) const;
+
+  // Writes the side x side window with its top-left cell at (left, top) row
+  // by row, like GameBoard::getSnapshot. Cells off the board read as EMPTY.
+  void getViewport(int left, int top, int side, char *cells,
+                   bool showShips) const;
+
+private:
+  struct Ship {
+    uint32_t origin;
+    uint8_t length;
+    bool horizontal;
+    uint8_t hits;
+  };
+
+  int boardSize;
+  std::vector<uint8_t> fleet;
+  std::vector<Ship> ships;
+  // Ship cell -> index into ships.
+  CellMap<uint32_t> shipCells;
+  CellSet shots;
+  uint32_t cellsAfloat;
+
+  uint32_t cellOf(int x, int y) const {
+    return (uint32_t)y * (uint32_t)boardSize + (uint32_t)x;
+  }
+  bool fits(int x, int y, int length, bool horizontal, bool noTouching) const;
+  void addShip(int x, int y, int length, bool horizontal);
+};
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "Metrics.h"
+#include "Transport.h"
+#include "protocol.h"
+
+#include <atomic>
+#include <memory>
+#include <pthread.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Fan-out of game events to spectators. publish() encodes an event once into
+// a SharedFrame and only queues it; a background thread hands the same frame
+// to every spectator of the game, so a game with hundreds of viewers costs
+// its players one encode and one queue push per event.
+//
+// Spectators are sent to with ServerTransport::sendShared(): one that has
+// more than MAX_BACKLOG frames waiting is dropped from the game instead of
+// holding frames (or the players) back.
+//
+// Requests are applied by the thread in the order they are made, so a
+// spectator gets exactly the events published after its subscribe().
+class SpectatorHub {
+public:
+  SpectatorHub(ServerTransport &transport, Metrics &metrics, int games);
+  ~SpectatorHub();
+
+  SpectatorHub(const SpectatorHub &) = delete;
+  SpectatorHub &operator=(const SpectatorHub &) = delete;
+
+  void start();
+  // Delivers everything still queued, then stops the thread.
+  void stop();
+
+  // Makes login a spectator of game, leaving any game it watched before.
+  void subscribe(int game, const std::string &login);
+  void unsubscribe(const std::string &login);
+  // Drops every spectator of game, for a game that ended.
+  void close(int game);
+
+  // Cheap check before building an event; may briefly report spectators
+  // that have just been dropped, never miss one that subscribed.
+  bool watched(int game) const {
+    return audience[game].load(std::memory_order_acquire) > 0;
+  }
+  void publish(int game, const Packet &pkt);
+
+private:
+  enum RequestKind { REQ_SUBSCRIBE, REQ_UNSUBSCRIBE, REQ_CLOSE, REQ_PUBLISH };
+
+  struct Request {
+    RequestKind kind;
+    int game;
+    std::string login;
+    SharedFrame frame;
+  };
+
+  ServerTransport &transport;
+  Metrics &metrics;
+
+  // Told to a dropped spectator, past its backlog limit.
+  SharedFrame droppedNotice;
+
+  // Per game: subscribe() calls minus spectators the thread has removed.
+  std::unique_ptr<std::atomic<int>[]> audience;
+  int gameCount;
+
+  // Only touched by the hub thread.
+  std::unordered_map<int, std::vector<std::string>> spectatorsByGame;
+  std::unordered_map<std::string, int> gameBySpectator;
+
+  pthread_t thread;
+  bool running;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  // Taken as a whole by the thread, which swaps in its emptied batch.
+  std::vector<Request> queue;
+
+  // Frames a spectator may have waiting before it is dropped.
+  static const size_t MAX_BACKLOG = 32;
+
+  void push(Request request);
+  static void *threadWrapper(void *context);
+  void hubLoop();
+  void apply(Request &request);
+  void remove(const std::string &login);
+  void deliver(int game, const SharedFrame &frame);
+};
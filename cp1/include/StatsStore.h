@@ -0,0 +1,105 @@
+#pragma once
+
+#include "protocol.h"
+
+#include <cstdint>
+#include <deque>
+#include <pthread.h>
+#include <string>
+#include <string_view>
+#include <sys/types.h>
+#include <vector>
+
+// On-disk form of a player's statistics, the same in the snapshot and in the
+// log.
+struct StatsRecord {
+  char login[32];
+  uint32_t gamesPlayed;
+  uint32_t wins;
+  uint32_t losses;
+  uint32_t totalShots;
+  uint32_t hits;
+};
+
+// Persistent player statistics.
+//
+// <path>.dat is a snapshot: a header followed by fixed-size records, mapped
+// MAP_PRIVATE so updates never touch the file. Every update appends the full
+// new record to <path>.log through a userspace buffer; nothing is fsync'ed on
+// the hot path. Startup maps the snapshot, indexes it and replays the log.
+// Once the log outgrows the snapshot, an update only marks compaction due;
+// compactIfDue(), called off the handler threads, writes a copy of the
+// records to a new snapshot without holding the lock, fsyncs it, renames it
+// into place and starts a new log with whatever was appended meanwhile.
+//
+// A crash loses at most the unflushed buffer: the buffer is flushed when full
+// and after every finished game. A torn entry at the end of the log is
+// ignored on replay.
+class StatsStore {
+public:
+  explicit StatsStore(const std::string &path);
+  ~StatsStore();
+
+  bool open();
+  void close();
+
+  void recordShot(const std::string &login, bool hit);
+  void recordGame(const std::string &winner, const std::string &loser);
+  // Adds the counters of delta to the record of delta.login.
+  void merge(const StatsRecord &delta);
+  PlayerStats get(const std::string &login);
+
+  size_t size();
+
+  // Compacts the log if it has outgrown the snapshot. Slow (writes and
+  // fsyncs the whole snapshot), so never call it on a handler thread.
+  void compactIfDue();
+
+private:
+  struct LogEntry {
+    uint32_t magic;
+    StatsRecord record;
+  };
+
+  std::string snapshotPath;
+  std::string logPath;
+
+  // Records 0..snapshotCount-1 live in the mapping, later ones in added.
+  StatsRecord *snapshot;
+  size_t snapshotCount;
+  size_t mappedSize;
+  std::deque<StatsRecord> added;
+
+  // Open-addressing index over the records themselves: a slot holds id + 1
+  // (0 = empty), keys are compared against the record's login. No per-player
+  // allocation, so indexing millions of records on startup is one pass.
+  std::vector<uint32_t> slots;
+  size_t indexed;
+
+  int logFd;
+  size_t logEntries;
+  char logBuffer[64 * sizeof(LogEntry)];
+  size_t logBuffered;
+  bool compactionDue;
+
+  pthread_mutex_t mutex;
+
+  // Expect mutex to be held.
+  StatsRecord *record(uint32_t id);
+  static std::string_view loginOf(const StatsRecord &rec);
+  StatsRecord *find(std::string_view login);
+  void insert(uint32_t id);
+  void rehash(size_t count);
+  StatsRecord *findOrCreate(const std::string &login);
+  void append(const StatsRecord &rec);
+  void flushLog();
+  bool mapSnapshot();
+  void unmapSnapshot();
+  void replayLog();
+  bool writeSnapshot(const std::vector<StatsRecord> &records);
+  bool readLog(off_t from, std::vector<LogEntry> &entries);
+  void restartLog(const std::vector<LogEntry> &tail);
+
+  // Expect mutex not to be held.
+  bool compact();
+};
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Hierarchical timer wheel in the style of Varghese and Lauck. LEVELS wheels
+// of SLOTS slots each, a slot of level l spans SLOTS^l ticks. Scheduling and
+// cancelling unlink or link one node; a timer far in the future sits on a
+// coarse level and is cascaded down as its slot comes round, so a timer
+// moves at most LEVELS times in its life.
+//
+// Not thread safe; the caller serialises access.
+class TimerWheel {
+public:
+  // 0 is never a valid id.
+  typedef uint64_t TimerId;
+
+  struct Expired {
+    int kind;
+    uint32_t target;
+  };
+
+  TimerWheel(uint64_t nowMs, int tickMs);
+
+  // Fires kind/target once delayMs have passed since nowMs, rounded up to
+  // whole ticks.
+  TimerId schedule(uint64_t nowMs, uint64_t delayMs, int kind,
+                   uint32_t target);
+  // False if the timer already fired or was cancelled.
+  bool cancel(TimerId id);
+
+  // Runs the wheel up to nowMs and appends every timer that fired.
+  void advance(uint64_t nowMs, std::vector<Expired> &expired);
+
+  size_t size() const { return armed; }
+
+private:
+  static const int LEVELS = 4;
+  static const int SLOT_BITS = 6;
+  static const int SLOTS = 1 << SLOT_BITS;
+
+  struct Node {
+    uint64_t expiresTick;
+    int kind;
+    uint32_t target;
+    // Bumped whenever the node is freed, so stale ids miss.
+    uint32_t generation;
+    int32_t prev;
+    int32_t next;
+    int16_t level;
+    int16_t slot;
+  };
+
+  int tickMs;
+  uint64_t startMs;
+  uint64_t currentTick;
+  size_t armed;
+  std::vector<Node> nodes;
+  std::vector<int32_t> freeNodes;
+  int32_t heads[LEVELS][SLOTS];
+
+  void place(int32_t index);
+  void unlink(int32_t index);
+  void release(int32_t index);
+  // Moves the timers of one coarse slot down to where they now belong.
+  void cascade(int level, int slot);
+};
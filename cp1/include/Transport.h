@@ -0,0 +1,106 @@
+#pragma once
+
+#include "protocol.h"
+#include "wire.h"
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <sys/types.h>
+#include <vector>
+
+// An encoded frame that several outbound queues can hold at once.
+typedef std::shared_ptr<const std::string> SharedFrame;
+
+// Receives packets decoded by a server transport.
+class TransportListener {
+public:
+  virtual ~TransportListener() {}
+  // Everything decoded in one wakeup, in arrival order. The listener may
+  // clear or reuse the vector.
+  virtual void onPackets(std::vector<Packet> &packets) = 0;
+};
+
+// A deployment may run up to MAX_SHARDS server processes. Every login has a
+// home shard; shard 0 uses the plain endpoint names, so a single server is a
+// deployment of one shard.
+#define MAX_SHARDS 64
+
+// base for shard 0, base_<shard> otherwise.
+std::string shardEndpoint(const std::string &base, int shard);
+// Stable across processes and builds (FNV-1a), unlike std::hash.
+int loginShard(std::string_view login, int shardCount);
+
+// Server end of a transport: one inbound endpoint shared by all clients and
+// one outbound channel per logged-in client, addressed by login.
+//
+// poll() is only called from the server's event loop thread; connect(),
+// disconnect() and send() may be called from any worker thread.
+class ServerTransport {
+public:
+  virtual ~ServerTransport() {}
+
+  // Picks the endpoint to listen on; call before open().
+  void setShard(int index) { shard = index; }
+
+  virtual bool open() = 0;
+  virtual void close() = 0;
+
+  // Waits up to timeoutMs (-1 = forever) for inbound traffic and passes every
+  // complete packet to listener. Also retries queued outbound frames.
+  // Returns false once the transport has failed for good.
+  virtual bool poll(int timeoutMs, TransportListener &listener) = 0;
+
+  // Gives the client a fresh channel if its old one is still closing.
+  virtual bool connect(const std::string &login) = 0;
+  virtual void disconnect(const std::string &login) = 0;
+  // Like disconnect(), but frames already queued for the client, such as a
+  // redirect, are delivered first; the channel closes once they are out.
+  virtual void disconnectWhenFlushed(const std::string &login) = 0;
+
+  // Never blocks: a frame the client cannot take yet is queued, a client
+  // whose queue overflows is disconnected. Returns false if the frame was
+  // dropped.
+  virtual bool send(const std::string &login, const char *frame,
+                    size_t frameSize) = 0;
+
+  // For a frame fanned out to many clients: if it has to wait, the queue
+  // keeps a reference instead of a copy. A client that already has
+  // maxQueued frames waiting is not disconnected; the frame is refused and
+  // false returned, so the caller can stop sending to it.
+  virtual bool sendShared(const std::string &login, const SharedFrame &frame,
+                          size_t maxQueued) = 0;
+
+protected:
+  static const size_t MAX_OUTBOUND_QUEUE = 256;
+
+  int shard = 0;
+};
+
+// Client end of a transport.
+class ClientTransport {
+public:
+  virtual ~ClientTransport() {}
+
+  // Picks the server to connect to; takes effect on the next open().
+  void setShard(int index) { shard = index; }
+
+  // Creates the client's inbound endpoint and connects to the server. Fails
+  // if no server is running.
+  virtual bool open(const std::string &login) = 0;
+  virtual void close() = 0;
+
+  virtual bool send(const char *frame, size_t frameSize) = 0;
+
+  // Waits for inbound bytes and appends them to reader. Returns the number
+  // of bytes received, 0 if nothing arrived within the transport's wait slice
+  // or -1 on error.
+  virtual ssize_t receive(FrameReader &reader) = 0;
+
+protected:
+  int shard = 0;
+};
+
+// name is "fifo" or "shm"; returns nullptr for an unknown name.
+ServerTransport *createServerTransport(const std::string &name);
+ClientTransport *createClientTransport(const std::string &name);
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstdint>
+
+// Bit set of WORDS * 64 bits with the operators GameBoard uses on a plain
+// integer mask, for boards with more cells than an unsigned __int128 holds.
+template <int WORDS> class WideMask {
+public:
+  WideMask(uint64_t low = 0) : words{} { words[0] = low; }
+
+  WideMask operator|(const WideMask &other) const {
+    WideMask result;
+    for (int i = 0; i < WORDS; ++i) {
+      result.words[i] = words[i] | other.words[i];
+    }
+    return result;
+  }
+
+  WideMask operator&(const WideMask &other) const {
+    WideMask result;
+    for (int i = 0; i < WORDS; ++i) {
+      result.words[i] = words[i] & other.words[i];
+    }
+    return result;
+  }
+
+  WideMask operator~() const {
+    WideMask result;
+    for (int i = 0; i < WORDS; ++i) {
+      result.words[i] = ~words[i];
+    }
+    return result;
+  }
+
+  WideMask operator<<(int count) const {
+    WideMask result;
+    int wordShift = count / 64;
+    int bitShift = count % 64;
+    for (int i = WORDS - 1; i >= wordShift; --i) {
+      uint64_t word = words[i - wordShift] << bitShift;
+      if (bitShift != 0 && i - wordShift > 0) {
+        word |= words[i - wordShift - 1] >> (64 - bitShift);
+      }
+      result.words[i] = word;
+    }
+    return result;
+  }
+
+  WideMask operator>>(int count) const {
+    WideMask result;
+    int wordShift = count / 64;
+    int bitShift = count % 64;
+    for (int i = 0; i + wordShift < WORDS; ++i) {
+      uint64_t word = words[i + wordShift] >> bitShift;
+      if (bitShift != 0 && i + wordShift + 1 < WORDS) {
+        word |= words[i + wordShift + 1] << (64 - bitShift);
+      }
+      result.words[i] = word;
+    }
+    return result;
+  }
+
+  WideMask &operator|=(const WideMask &other) { return *this = *this | other; }
+  WideMask &operator&=(const WideMask &other) { return *this = *this & other; }
+
+  bool operator==(const WideMask &other) const {
+    for (int i = 0; i < WORDS; ++i) {
+      if (words[i] != other.words[i]) {
+        return false;
+      }
+    }
+    return true;
+  }
+  bool operator!=(const WideMask &other) const { return !(*this == other); }
+
+  // Index of the lowest set bit, the mask must not be empty.
+  int lowestBit() const {
+    int i = 0;
+    while (words[i] == 0) {
+      ++i;
+    }
+    return 64 * i + __builtin_ctzll(words[i]);
+  }
+
+  void clearLowestBit() {
+    for (uint64_t &word : words) {
+      if (word != 0) {
+        word &= word - 1;
+        return;
+      }
+    }
+  }
+
+private:
+  uint64_t words[WORDS];
+};
+
+inline int lowestBit(unsigned __int128 mask) {
+  uint64_t low = (uint64_t)mask;
+  if (low != 0) {
+    return __builtin_ctzll(low);
+  }
+  return 64 + __builtin_ctzll((uint64_t)(mask >> 64));
+}
+
+inline void clearLowestBit(unsigned __int128 &mask) { mask &= mask - 1; }
+
+template <int WORDS> int lowestBit(const WideMask<WORDS> &mask) {
+  return mask.lowestBit();
+}
+
+template <int WORDS> void clearLowestBit(WideMask<WORDS> &mask) {
+  mask.clearLowestBit();
+}
@@ -1,12 +1,15 @@
 #pragma once
 
-#include "GameLogic.h"
+#include "AnyBoard.h"
 
+#include <cstdint>
 #include <string>
 
 #define SERVER_PIPE "/tmp/battleship_server_pipe"
 #define CLIENT_PIPE_PREFIX "/tmp/client_"
 
+#define NUM_GAME_SHARDS 64
+
 enum MsgType {
   LOGIN,
   CREATE_GAME,
@@ -23,35 +26,128 @@ enum MsgType {
   S_SHOT_RESULT,
   S_GAME_OVER,
   S_BOARD,
-  S_STATS
+  S_STATS,
+  GET_BOARD,
+  S_BOARD_DELTA,
+  S_ROOM_ADDED,
+  S_ROOM_REMOVED,
+  S_LOGIN_ACK,
+  ADMIN_METRICS,
+  S_METRICS,
+  QUEUE,
+  HEARTBEAT,
+  S_REDIRECT,
+  SPECTATE,
+  S_WATCHING,
+  // Raised by the server's timer wheel, never sent on the wire.
+  TIMER_EXPIRED,
+  // Not a message; keep last.
+  MSG_TYPE_COUNT
 };
 
+// Board ids used by S_BOARD and S_BOARD_DELTA. A spectator gets the boards
+// of seat 0 and 1 under the same two ids.
+enum BoardId { BOARD_OWN = 0, BOARD_RADAR = 1 };
+
+// S_REDIRECT asks the client to log out and log in again on shard x. y says
+// why: the login belongs to that shard, or an opponent is waiting there and
+// the game starts on login.
+enum RedirectReason { REDIRECT_HOME = 0, REDIRECT_MATCH = 1 };
+
+// Side of the board window sent in one S_BOARD; smaller boards are sent
+// whole.
+#define VIEWPORT_SIZE 20
+
+// In-memory form of a message. On the pipes it travels as a compact frame,
+// see wire.h. Board messages reuse the fields: x is the BoardId, for S_BOARD
+// y is the board size, left and top give the first column and row of the
+// window and payload holds one CellState per window cell, for S_BOARD_DELTA
+// y is the number of (int16 x, int16 y, uint8 state) records in payload.
+// GET_BOARD asks for the window at (x, y). SPECTATE carries the login of a
+// player whose game to watch in payload; S_WATCHING confirms it with the
+// game name and the two players' logins, one per line, in payload.
 struct Packet {
-  int type;
-  char sender[32];
-  char gameName[64];
-  char payload[512];
-  int x;
-  int y;
-  int shotResult;
+  int type = 0;
+  unsigned int session = 0;
+  char sender[32] = {};
+  char gameName[64] = {};
+  char payload[512] = {};
+  int x = 0;
+  int y = 0;
+  int shotResult = 0;
+  int left = 0;
+  int top = 0;
 };
 
+static const size_t CELL_UPDATE_SIZE = 5;
+
+// Side of the window a board of size cells is sent in.
+inline int viewportSide(int size) {
+  return size < VIEWPORT_SIZE ? size : VIEWPORT_SIZE;
+}
+
+#define NO_PLAYER (-1)
+#define NO_GAME (-1)
+#define NO_ROOM (-1)
+
 struct Player {
+  int handle = NO_PLAYER;
+  unsigned int sessionId = 0;
   std::string login;
-  bool inGame;
-  std::string gameName;
-  GameBoard board;
-  bool isTurn;
-  std::string opponent;
+  // GamePool handle of the game being played, and the room the player
+  // created and waits in.
+  int game = NO_GAME;
+  int room = NO_ROOM;
+  // Shard mutex of the current or last game. Only set under the list write
+  // lock, so a shot can pick the mutex before it looks at game.
+  int shard = 0;
+  // Waiting for an automatic match; the ticket of the current queue entry.
+  bool queued = false;
+  unsigned int queueTicket = 0;
+  // Monotonic time of the last packet from the client, and the TimerWheel
+  // ids of its idle and turn timers (0 = not armed).
+  uint64_t lastSeenMs = 0;
+  uint64_t idleTimer = 0;
+  // Shard that keeps the player's statistics. A player on another shard is
+  // a guest there for one cross-shard game; its results are mailed home.
+  int homeShard = 0;
+  // Sent back home after its game here. Requests it made before it saw the
+  // redirect are dropped rather than answered with another one.
+  bool sentHome = false;
+  // Has subscribed to a game as a spectator. The SpectatorHub may have
+  // dropped it since, so this only says whether to unsubscribe.
+  bool spectating = false;
+};
+
+// A running game. Seat 0 is the room creator (or the first of a match),
+// seat 1 shoots first. Guarded by the shard mutex of the game.
+struct GameSession {
+  int handle = NO_GAME;
+  std::string name;
+  int players[2] = {NO_PLAYER, NO_PLAYER};
+  // boards[seat] holds the fleet of that seat.
+  AnyBoard boards[2];
+  int turn = 1;
+  // Shots and hits per seat; a guest's are mailed home with the result.
+  uint32_t shots[2] = {};
+  uint32_t hits[2] = {};
+  // TimerWheel id of the turn timer of the seat to move (0 = not armed).
+  uint64_t turnTimer = 0;
+  uint64_t turnDeadlineMs = 0;
+
+  int seatOf(int player) const {
+    return players[0] == player ? 0 : players[1] == player ? 1 : -1;
+  }
 };
 
 struct GameRoom {
   std::string name;
   std::string creator;
-  std::string player1;
-  std::string player2;
-  bool isFull;
-  bool isActive;
+  BoardMode mode = MODE_CLASSIC;
+  int player1 = NO_PLAYER;
+  int player2 = NO_PLAYER;
+  bool isFull = false;
+  bool isActive = false;
 };
 
 struct PlayerStats {
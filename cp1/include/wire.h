@@ -0,0 +1,85 @@
+#pragma once
+
+#include "protocol.h"
+
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <sys/types.h>
+#include <vector>
+
+// Every message on a pipe is one frame: a fixed header followed by a body
+// whose layout depends on the type:
+//
+//   LOGIN                          login
+//   CREATE_GAME                    uint8 board mode, game name
+//   JOIN_GAME                      game name
+//   SPECTATE                       login
+//   SHOOT                          int16 x, int16 y
+//   GET_GAME_LIST                  int16 page
+//   S_SHOT_RESULT                  int16 x, int16 y, uint8 result, text
+//   S_GAME_CREATED, S_ROOM_ADDED,  uint8 name length, game name, text
+//   S_ROOM_REMOVED, S_WATCHING
+//   GET_BOARD                      int16 left, int16 top
+//   S_BOARD                        uint8 board, uint16 size, int16 left,
+//                                  int16 top, 2 bits per window cell
+//   S_BOARD_DELTA                  uint8 board, uint8 count, count x
+//                                  (int16 x, int16 y, uint8 state)
+//   other S_* types                text
+//   everything else                empty
+//
+// Client frames carry the session id handed out with S_LOGIN_ACK, the
+// server resolves the sender from it. Integers use host byte order since both
+// ends always share a host.
+struct FrameHeader {
+  uint8_t type;
+  uint8_t flags;
+  uint16_t length;
+  uint32_t session;
+};
+
+static const size_t FRAME_HEADER_SIZE = sizeof(FrameHeader);
+static const size_t MAX_FRAME_BODY = sizeof(Packet::payload) + 8;
+static const size_t MAX_FRAME_SIZE = FRAME_HEADER_SIZE + MAX_FRAME_BODY;
+
+// A frame is always written with a single write(), which the kernel keeps
+// atomic on a FIFO only up to PIPE_BUF bytes.
+static_assert(MAX_FRAME_SIZE <= PIPE_BUF, "frame must fit into PIPE_BUF");
+
+// Serializes pkt into out (at least MAX_FRAME_SIZE bytes), returns the frame
+// size.
+size_t encodeFrame(const Packet &pkt, char *out);
+
+// Parses one complete frame. Returns false for unknown types or bodies that
+// do not match their type.
+bool decodeFrame(const char *frame, size_t size, Packet &pkt);
+
+// Reassembles frames from a byte stream: a read may end in the middle of a
+// frame, the remainder is kept until the next fill().
+class FrameReader {
+public:
+  static const size_t DEFAULT_CAPACITY = 8 * MAX_FRAME_SIZE;
+
+  explicit FrameReader(size_t capacity = DEFAULT_CAPACITY);
+
+  // Reads whatever is available from fd. Same return value as read().
+  ssize_t fill(int fd);
+
+  // For sources other than a descriptor: reserve() returns the free space
+  // (compacting the buffer first), commit() appends the n bytes written there.
+  char *reserve(size_t &available);
+  void commit(size_t n) { end += n; }
+
+  // Extracts the next complete frame. Frames that fail to decode are
+  // skipped; a header with an impossible length drops the whole buffer.
+  bool next(Packet &pkt);
+
+  size_t buffered() const { return end - start; }
+  // Drops everything buffered, e.g. after switching to another server.
+  void clear() { start = end = 0; }
+
+private:
+  std::vector<char> buffer;
+  size_t start;
+  size_t end;
+};
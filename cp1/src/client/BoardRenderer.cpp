@@ -0,0 +1,286 @@
+#include "BoardRenderer.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+static char cellSymbol(char state) {
+  switch (state) {
+  case SHIP:
+    return '#';
+  case MISS:
+    return '*';
+  case HIT:
+    return 'X';
+  default:
+    return '.';
+  }
+}
+
+static std::string pad(const std::string &text, int width) {
+  return std::string(width - std::min<int>(width, text.size()), ' ') + text;
+}
+
+static std::string moveTo(int row, int column) {
+  return "\x1b[" + std::to_string(row) + ";" + std::to_string(column) + "H";
+}
+
+BoardRenderer::BoardRenderer()
+    : boardSize(0), movable(true), changed{}, paneRows(0), screenRows(0),
+      labelWidth(0), cellWidth(0), panelWidth(0), layoutStale(true) {
+  const char *term = getenv("TERM");
+  terminal = isatty(STDOUT_FILENO) && term && strcmp(term, "dumb") != 0;
+}
+
+bool BoardRenderer::setWindow(BoardId board, int size, int left, int top,
+                              const char *cells) {
+  int windowSide = viewportSide(size);
+  if (board > BOARD_RADAR || windowSide < 1 ||
+      windowSide * windowSide > (int)sizeof(View::cells)) {
+    return false;
+  }
+  if (size != boardSize) {
+    boardSize = size;
+    layoutStale = true;
+  }
+  View &view = views[board];
+  view.left = left;
+  view.top = top;
+  view.received = true;
+  memcpy(view.cells, cells, windowSide * windowSide);
+  changed[board] = true;
+  return true;
+}
+
+void BoardRenderer::updateCells(BoardId board, const char *updates,
+                                int count) {
+  if (board > BOARD_RADAR || !views[board].received) {
+    return;
+  }
+  View &view = views[board];
+  int windowSide = side();
+  for (int i = 0; i < count; ++i) {
+    const char *update = updates + CELL_UPDATE_SIZE * i;
+    int16_t coords[2];
+    memcpy(coords, update, sizeof(coords));
+    int col = coords[0] - view.left;
+    int row = coords[1] - view.top;
+    if (col >= 0 && col < windowSide && row >= 0 && row < windowSide) {
+      view.cells[row * windowSide + col] = update[sizeof(coords)];
+      changed[board] = true;
+    }
+  }
+}
+
+void BoardRenderer::setTitles(const std::string &own,
+                              const std::string &radar, bool canMove) {
+  if (titles[BOARD_OWN] == own && titles[BOARD_RADAR] == radar &&
+      movable == canMove) {
+    return;
+  }
+  titles[BOARD_OWN] = own;
+  titles[BOARD_RADAR] = radar;
+  movable = canMove;
+  layoutStale = true;
+}
+
+void BoardRenderer::render(std::string &out) {
+  if (!views[BOARD_OWN].received && !views[BOARD_RADAR].received) {
+    return;
+  }
+  if (terminal && layoutStale) {
+    layoutStale = false;
+    bool hadPane = paneRows > 0;
+    if (!setUpPane(out) && hadPane) {
+      out += "\x1b[r" + moveTo(screenRows, 1) + "\n";
+    }
+  }
+
+  for (int board = BOARD_OWN; board <= BOARD_RADAR; ++board) {
+    if (!views[board].received) {
+      continue;
+    }
+    if (paneRows == 0) {
+      if (changed[board]) {
+        renderPlain((BoardId)board, out);
+      }
+    } else if (!shown[board].drawn || shown[board].left != views[board].left ||
+               shown[board].top != views[board].top) {
+      drawPanel((BoardId)board, out);
+    } else if (changed[board]) {
+      drawChanges((BoardId)board, out);
+    }
+    changed[board] = false;
+  }
+}
+
+void BoardRenderer::release(std::string &out) {
+  if (paneRows > 0) {
+    out += "\x1b[r" + moveTo(screenRows, 1) + "\n";
+    paneRows = 0;
+  }
+  for (int board = BOARD_OWN; board <= BOARD_RADAR; ++board) {
+    views[board].received = false;
+    shown[board].drawn = false;
+    changed[board] = false;
+  }
+  layoutStale = true;
+}
+
+std::string BoardRenderer::rangeLine(int left, int top) const {
+  int last = side() - 1;
+  return "(" + std::to_string(left) + ", " + std::to_string(top) + ") to (" +
+         std::to_string(left + last) + ", " + std::to_string(top + last) +
+         ") of " + std::to_string(boardSize) + "x" +
+         std::to_string(boardSize) +
+         (movable ? ", move with /view <x> <y>" : "");
+}
+
+void BoardRenderer::renderPlain(BoardId board, std::string &out) const {
+  const View &view = views[board];
+  int windowSide = side();
+  out += "\n" + titles[board] + "\n";
+  if (windowSide < boardSize) {
+    out += rangeLine(view.left, view.top) + "\n";
+  }
+  // Columns are as wide as the longest coordinate shown, plus a space.
+  int width = (int)std::to_string(std::max(view.left, view.top) +
+                                  windowSide - 1).size();
+  int columnWidth = width + 1;
+
+  out += std::string(width, ' ');
+  for (int x = 0; x < windowSide; ++x) {
+    out += pad(std::to_string(view.left + x), columnWidth);
+  }
+  out += "\n" + std::string(width, ' ') +
+         std::string(columnWidth * windowSide + 1, '-') + "\n";
+
+  for (int y = 0; y < windowSide; ++y) {
+    out += pad(std::to_string(view.top + y), width);
+    for (int x = 0; x < windowSide; ++x) {
+      out += std::string(columnWidth - 1, ' ');
+      out += cellSymbol(view.cells[y * windowSide + x]);
+    }
+    out += "\n";
+  }
+}
+
+// Lays the pane out for the current board size and titles and puts the
+// screen setup at the front of out. False if the terminal is too small.
+bool BoardRenderer::setUpPane(std::string &out) {
+  paneRows = 0;
+  winsize window;
+  if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &window) != 0 || window.ws_row == 0) {
+    return false;
+  }
+
+  // Fixed label width for the whole board, so moving the window never
+  // changes the layout.
+  int windowSide = side();
+  labelWidth = (int)std::to_string(std::max(boardSize - 1, 0)).size();
+  cellWidth = labelWidth + 1;
+  panelWidth = labelWidth + cellWidth * windowSide + 1;
+  for (const std::string &title : titles) {
+    panelWidth = std::max(panelWidth, (int)title.size());
+  }
+  if (windowSide < boardSize) {
+    int farthest = boardSize - windowSide;
+    panelWidth =
+        std::max(panelWidth, (int)rangeLine(farthest, farthest).size());
+  }
+
+  // Title, column labels, rule, the cells, window range and a blank line.
+  int rows = windowSide + 5;
+  if (window.ws_col < 2 * panelWidth + PANEL_GAP ||
+      window.ws_row < rows + MIN_TEXT_ROWS) {
+    return false;
+  }
+  paneRows = rows;
+  screenRows = window.ws_row;
+  shown[BOARD_OWN].drawn = false;
+  shown[BOARD_RADAR].drawn = false;
+
+  // Pushes what is on screen into the scrollback, then keeps the top rows
+  // out of the scrolling region and parks the cursor right below them.
+  out.insert(0, "\x1b[r" + moveTo(screenRows, 1) +
+                    std::string(screenRows, '\n') + "\x1b[" +
+                    std::to_string(paneRows + 1) + ";" +
+                    std::to_string(screenRows) + "r" +
+                    moveTo(paneRows + 1, 1));
+  return true;
+}
+
+void BoardRenderer::drawPanel(BoardId board, std::string &out) {
+  const View &view = views[board];
+  int windowSide = side();
+  int column = panelColumn(board);
+  auto line = [&](int row, std::string text) {
+    text.resize(panelWidth, ' ');
+    out += moveTo(row, column) + text;
+  };
+
+  out += "\x1b" "7";
+  line(1, titles[board]);
+  std::string labels(labelWidth, ' ');
+  for (int x = 0; x < windowSide; ++x) {
+    labels += pad(std::to_string(view.left + x), cellWidth);
+  }
+  line(2, labels);
+  line(3, std::string(labelWidth, ' ') +
+              std::string(cellWidth * windowSide + 1, '-'));
+  for (int y = 0; y < windowSide; ++y) {
+    std::string text = pad(std::to_string(view.top + y), labelWidth);
+    for (int x = 0; x < windowSide; ++x) {
+      text += std::string(cellWidth - 1, ' ');
+      text += cellSymbol(view.cells[y * windowSide + x]);
+    }
+    line(4 + y, text);
+  }
+  line(4 + windowSide,
+       windowSide < boardSize ? rangeLine(view.left, view.top) : "");
+  out += "\x1b" "8";
+
+  Shown &screen = shown[board];
+  screen.drawn = true;
+  screen.left = view.left;
+  screen.top = view.top;
+  memcpy(screen.cells, view.cells, windowSide * windowSide);
+}
+
+void BoardRenderer::drawChanges(BoardId board, std::string &out) {
+  const View &view = views[board];
+  Shown &screen = shown[board];
+  int windowSide = side();
+  int column = panelColumn(board) + labelWidth;
+  size_t start = out.size();
+  // Where the cursor is after the last cell written, 0 before the first.
+  int cursorRow = 0;
+  int cursorColumn = 0;
+
+  for (int y = 0; y < windowSide; ++y) {
+    for (int x = 0; x < windowSide; ++x) {
+      int cell = y * windowSide + x;
+      if (screen.cells[cell] == view.cells[cell]) {
+        continue;
+      }
+      screen.cells[cell] = view.cells[cell];
+      int row = 4 + y;
+      int symbolColumn = column + (x + 1) * cellWidth - 1;
+      // The next cell over is only padding away, cheaper to type over.
+      if (row == cursorRow && symbolColumn == cursorColumn + cellWidth - 1) {
+        out += std::string(cellWidth - 1, ' ');
+      } else {
+        out += moveTo(row, symbolColumn);
+      }
+      out += cellSymbol(view.cells[cell]);
+      cursorRow = row;
+      cursorColumn = symbolColumn + 1;
+    }
+  }
+  if (out.size() != start) {
+    out.insert(start, "\x1b" "7");
+    out += "\x1b" "8";
+  }
+}
@@ -1,11 +1,67 @@
 #include "ClientApp.h"
 
+#include <cerrno>
 #include <cstring>
+#include <ctime>
 #include <iostream>
 #include <unistd.h>
 #include <sstream>
 
-ClientApp::ClientApp() : isRunning(true), inGame(false) {}
+static const char MAIN_MENU[] =
+    "\nMain Menu\n"
+    "Commands:\n"
+    "  /create <name> [classic|large|huge|event]\n"
+    "                   - Create new game\n"
+    "  /join <name>     - Join existing game\n"
+    "  /queue           - Get matched with an opponent\n"
+    "  /watch <login>   - Watch the game of a player\n"
+    "  /list [page]     - Show available games\n"
+    "  /stats           - Show your statistics\n"
+    "  /quit            - Quit\n"
+    "> ";
+
+ClientApp::ClientApp(ClientTransport &transport, int shardCount)
+    : transport(transport), sessionId(0), shardCount(shardCount),
+      isRunning(true), inGame(false),
+      queued(false), watching(false), handshake(HS_CONNECTING),
+      promptPending(false) {
+  handshake_mutex = PTHREAD_MUTEX_INITIALIZER;
+  handshake_cond = PTHREAD_COND_INITIALIZER;
+  send_mutex = PTHREAD_MUTEX_INITIALIZER;
+  output_mutex = PTHREAD_MUTEX_INITIALIZER;
+}
+
+ClientApp::~ClientApp() {
+  pthread_mutex_destroy(&handshake_mutex);
+  pthread_cond_destroy(&handshake_cond);
+  pthread_mutex_destroy(&send_mutex);
+  pthread_mutex_destroy(&output_mutex);
+}
+
+void ClientApp::setHandshake(HandshakeState state) {
+  pthread_mutex_lock(&handshake_mutex);
+  handshake = state;
+  pthread_cond_broadcast(&handshake_cond);
+  pthread_mutex_unlock(&handshake_mutex);
+}
+
+// Waits until the handshake reaches state. False on failure or timeout.
+bool ClientApp::waitHandshake(HandshakeState state, int timeoutSec) {
+  timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += timeoutSec;
+
+  pthread_mutex_lock(&handshake_mutex);
+  while (handshake < state && handshake != HS_FAILED) {
+    if (pthread_cond_timedwait(&handshake_cond, &handshake_mutex, &deadline) ==
+        ETIMEDOUT) {
+      break;
+    }
+  }
+  bool reached = handshake >= state && handshake != HS_FAILED;
+  pthread_mutex_unlock(&handshake_mutex);
+  return reached;
+}
 
 void *ClientApp::listenThreadWrapper(void *context) {
   ((ClientApp *)context)->listenLoop();
@@ -13,97 +69,225 @@ void *ClientApp::listenThreadWrapper(void *context) {
 }
 
 void ClientApp::listenLoop() {
-  std::string pipePath = CLIENT_PIPE_PREFIX + login;
-  NamedPipe myPipe(pipePath);
-
-  myPipe.removePipe();
-  if (!myPipe.create() || !myPipe.openPipe(O_RDWR)) {
-    std::cerr << "\n[Error] Could not create a personal channel to receive "
-                 "messages.\n";
+  transport.setShard(loginShard(login, shardCount));
+  if (!transport.open(login)) {
+    std::cerr << "\n[Error] Could not open a channel to the server (is it "
+                 "running?).\n";
+    setHandshake(HS_FAILED);
     return;
   }
+  setHandshake(HS_CONNECTED);
 
+  FrameReader reader;
   Packet pkt;
+  time_t lastHeartbeat = time(nullptr);
   while (isRunning) {
-    if (myPipe.receive(&pkt, sizeof(Packet))) {
-      switch (pkt.type) {
-      case S_MSG:
-        std::cout << "\n[SERVER]: " << pkt.payload << "\n" << std::flush;
-        if (!inGame) std::cout << "> " << std::flush;
-        break;
-      case S_GAME_LIST:
-        std::cout << "\n" << pkt.payload << "\n" << std::flush;
-        if (!inGame) std::cout << "> " << std::flush;
-        break;
-      case S_GAME_CREATED:
-        std::cout << "\n[GAME]: " << pkt.payload << "\n" << std::flush;
-        currentGame = pkt.sender;
-        std::cout << "> " << std::flush;
-        break;
-      case S_GAME_START:
-        std::cout << "\n[GAME]: GAME HAS BEEN STARTED! Opponent: "
-                  << pkt.payload
-                  << "\n[GAME]: Your ships are automatically spaced."
-                  << "\n[GAME]: Enter '/shoot X Y' (0-9)\n"
-                  << std::flush;
-        inGame = true;
-        std::cout << "> " << std::flush;
-        break;
-      case S_BOARD:
-        std::cout << "\n" << pkt.payload << "\n" << std::flush;
-        std::cout << "> " << std::flush;
-        break;
-      case S_SHOT_RESULT:
-        std::cout << "\n[RESULT]: " << pkt.payload << " (" << pkt.x << ", "
-                  << pkt.y << ")\n" << std::flush;
-        std::cout << "> " << std::flush;
-        break;
-      case S_GAME_OVER:
-        std::cout << "\n\n====================================\n";
-        std::cout << "               GAME OVER                \n";
-        std::cout << "=======================================\n";
-        std::cout << pkt.payload << "\n";
-        std::cout << "=======================================\n";
-        inGame = false;
-        currentGame = "";
-        showMainMenu();
-        break;
-      case S_STATS:
-        std::cout << "\n" << pkt.payload << "\n" << std::flush;
-        if (!inGame) std::cout << "> " << std::flush;
+    // Tells the server this client is still alive while the user is idle.
+    if (sessionId != 0 &&
+        time(nullptr) - lastHeartbeat >= HEARTBEAT_INTERVAL_SEC) {
+      Packet heartbeat;
+      heartbeat.type = HEARTBEAT;
+      sendPacket(heartbeat);
+      lastHeartbeat = time(nullptr);
+    }
+
+    if (transport.receive(reader) <= 0) {
+      continue;
+    }
+    // Not cancelled by /quit halfway through a batch, with output_mutex held.
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, nullptr);
+    pthread_mutex_lock(&output_mutex);
+    while (reader.next(pkt)) {
+      if (pkt.type == S_REDIRECT) {
+        output += "\n[SERVER]: " + std::string(pkt.payload) + "\n";
+        flushOutput();
+        switchShard(pkt.x);
+        // Whatever else the old server sent is stale now.
+        reader.clear();
         break;
       }
+      handlePacket(pkt);
     }
+    flushOutput();
+    pthread_mutex_unlock(&output_mutex);
+    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, nullptr);
+  }
+}
+
+// Expect output_mutex to be held.
+void ClientApp::flushOutput() {
+  if (promptPending) {
+    output += "> ";
+    promptPending = false;
+  }
+  // Whatever the main thread printed goes first.
+  std::cout << std::flush;
+  size_t written = 0;
+  while (written < output.size()) {
+    ssize_t n = write(STDOUT_FILENO, output.data() + written,
+                      output.size() - written);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      break;
+    }
+    written += n;
+  }
+  output.clear();
+}
+
+// Expect output_mutex to be held.
+void ClientApp::handlePacket(Packet &pkt) {
+  if (pkt.session != 0) {
+    sessionId = pkt.session;
+  }
+
+  switch (pkt.type) {
+  case S_LOGIN_ACK:
+    output += "\n[SERVER]: " + std::string(pkt.payload) + "\n";
+    setHandshake(HS_LOGGED_IN);
+    break;
+  case S_MSG:
+    output += "\n[SERVER]: " + std::string(pkt.payload) + "\n";
+    if (!inGame) promptPending = true;
+    break;
+  case S_GAME_LIST:
+    output += "\n" + std::string(pkt.payload) + "\n";
+    if (!inGame) promptPending = true;
+    break;
+  case S_GAME_CREATED:
+    output += "\n[GAME]: " + std::string(pkt.payload) + "\n";
+    currentGame = pkt.gameName;
+    promptPending = true;
+    break;
+  case S_ROOM_ADDED:
+    if (!inGame) {
+      output += "\n[LOBBY]: New game '" + std::string(pkt.gameName) +
+                "' by " + pkt.payload + ". Join with /join " + pkt.gameName +
+                "\n";
+      promptPending = true;
+    }
+    break;
+  case S_ROOM_REMOVED:
+    if (!inGame && currentGame != pkt.gameName) {
+      output += "\n[LOBBY]: Game '" + std::string(pkt.gameName) +
+                "' is no longer available\n";
+      promptPending = true;
+    }
+    break;
+  case S_WATCHING: {
+    // The seats 0 and 1 of the game, one per line.
+    std::string players[2];
+    std::istringstream names(pkt.payload);
+    std::getline(names, players[0]);
+    std::getline(names, players[1]);
+    watching = true;
+    boards.setTitles(players[0] + "'s board:", players[1] + "'s board:",
+                     false);
+    output += "\n[WATCH]: Watching '" + std::string(pkt.gameName) + "': " +
+              players[0] + " vs " + players[1] +
+              ". Use '/leave' to stop.\n";
+    break;
+  }
+  case S_GAME_START:
+    output += "\n[GAME]: GAME HAS BEEN STARTED! Opponent: " +
+              std::string(pkt.payload) +
+              "\n[GAME]: Your ships are automatically spaced."
+              "\n[GAME]: Enter '/shoot X Y'\n";
+    inGame = true;
+    queued = false;
+    watching = false;
+    boards.setTitles("YOUR BOARD:", "Opponent's board (Radar):", true);
+    promptPending = true;
+    break;
+  case S_BOARD:
+    if (boards.setWindow((BoardId)pkt.x, pkt.y, pkt.left, pkt.top,
+                         pkt.payload)) {
+      boards.render(output);
+      // A board drawn in place leaves the prompt where it was.
+      if (!boards.inPlace()) promptPending = true;
+    }
+    break;
+  case S_BOARD_DELTA:
+    boards.updateCells((BoardId)pkt.x, pkt.payload, pkt.y);
+    boards.render(output);
+    if (!boards.inPlace()) promptPending = true;
+    break;
+  case S_SHOT_RESULT:
+    output += "\n[RESULT]: " + std::string(pkt.payload) + " (" +
+              std::to_string(pkt.x) + ", " + std::to_string(pkt.y) + ")\n";
+    promptPending = true;
+    break;
+  case S_GAME_OVER:
+    boards.release(output);
+    output += "\n\n====================================\n";
+    output += "               GAME OVER                \n";
+    output += "=======================================\n";
+    output += std::string(pkt.payload) + "\n";
+    output += "=======================================\n";
+    inGame = false;
+    watching = false;
+    currentGame = "";
+    output += MAIN_MENU;
+    promptPending = false;
+    break;
+  case S_STATS:
+    output += "\n" + std::string(pkt.payload) + "\n";
+    if (!inGame) promptPending = true;
+    break;
+  case S_METRICS:
+    output += pkt.payload;
+    break;
   }
-  myPipe.closePipe();
-  myPipe.removePipe();
 }
 
 void ClientApp::sendPacket(Packet &pkt) {
-  NamedPipe serverPipe(SERVER_PIPE);
-  if (serverPipe.openPipe(O_WRONLY)) {
-    serverPipe.send(&pkt, sizeof(Packet));
-    serverPipe.closePipe();
-  } else {
+  pthread_mutex_lock(&send_mutex);
+  // Taken together with the transport, so a command never reaches a new
+  // shard with the session of the old one.
+  pkt.session = sessionId;
+  char frame[MAX_FRAME_SIZE];
+  size_t frameSize = encodeFrame(pkt, frame);
+  bool sent = transport.send(frame, frameSize);
+  pthread_mutex_unlock(&send_mutex);
+  if (!sent) {
     std::cout << "[Error] Server not available (not running).\n";
   }
 }
 
-void ClientApp::showMainMenu() {
-  std::cout << "\nMain Menu\n";
-  std::cout << "Commands:\n";
-  std::cout << "  /create <name>   - Create new game\n";
-  std::cout << "  /join <name>     - Join existing game\n";
-  std::cout << "  /list            - Show available games\n";
-  std::cout << "  /stats           - Show your statistics\n";
-  std::cout << "  /quit            - Quit\n";
-  std::cout << "> " << std::flush;
+void ClientApp::switchShard(int shard) {
+  Packet logout;
+  logout.type = LOGOUT;
+  if (sessionId != 0) {
+    sendPacket(logout);
+  }
+
+  pthread_mutex_lock(&send_mutex);
+  transport.close();
+  transport.setShard(shard);
+  sessionId = 0;
+  bool connected = transport.open(login);
+  pthread_mutex_unlock(&send_mutex);
+  if (!connected) {
+    std::cout << "[Error] Server " << shard << " is not available.\n";
+    return;
+  }
+
+  Packet auth;
+  auth.type = LOGIN;
+  strncpy(auth.sender, login.c_str(), sizeof(auth.sender) - 1);
+  sendPacket(auth);
 }
 
+void ClientApp::showMainMenu() { std::cout << MAIN_MENU << std::flush; }
+
 void ClientApp::showGameMenu() {
   std::cout << "\nGame Menu\n";
   std::cout << "Commands:\n";
-  std::cout << "  /shoot <x> <y>   - Make a shot (0-9)\n";
+  std::cout << "  /shoot <x> <y>   - Make a shot\n";
+  std::cout << "  /board           - Redraw both boards\n";
+  std::cout << "  /view <x> <y>    - Show the boards from (x, y) on\n";
   std::cout << "  /leave           - Leave current game\n";
   std::cout << "> " << std::flush;
 }
@@ -117,14 +301,25 @@ void ClientApp::start() {
     std::cerr << "Error of creating the thread.\n";
     return;
   }
-  sleep(1);
 
   Packet auth;
   auth.type = LOGIN;
   strcpy(auth.sender, login.c_str());
-  sendPacket(auth);
-
-  sleep(1);
+  bool loggedIn = false;
+  if (waitHandshake(HS_CONNECTED, LOGIN_TIMEOUT_SEC)) {
+    sendPacket(auth);
+    loggedIn = waitHandshake(HS_LOGGED_IN, LOGIN_TIMEOUT_SEC);
+    if (!loggedIn) {
+      std::cerr << "[Error] Login failed (the login may already be in use).\n";
+    }
+  }
+  if (!loggedIn) {
+    isRunning = false;
+    pthread_cancel(listenerThread);
+    pthread_join(listenerThread, NULL);
+    transport.close();
+    return;
+  }
   showMainMenu();
 
   std::string cmd;
@@ -132,7 +327,6 @@ void ClientApp::start() {
     std::cin >> cmd;
     
     Packet pkt;
-    memset(&pkt, 0, sizeof(Packet));
     strcpy(pkt.sender, login.c_str());
 
     if (cmd == "/quit") {
@@ -147,7 +341,22 @@ void ClientApp::start() {
       }
       std::string gameName;
       std::cin >> gameName;
+      std::string rest;
+      std::getline(std::cin, rest);
+      std::string modeName = "classic";
+      std::istringstream(rest) >> modeName;
+      int mode = 0;
+      while (mode < BOARD_MODES && modeName != BOARD_MODE_NAMES[mode]) {
+        ++mode;
+      }
+      if (mode == BOARD_MODES) {
+        std::cout << "Unknown board mode '" << modeName
+                  << "', use classic, large, huge or event.\n";
+        showMainMenu();
+        continue;
+      }
       pkt.type = CREATE_GAME;
+      pkt.x = mode;
       strcpy(pkt.gameName, gameName.c_str());
       sendPacket(pkt);
     } else if (cmd == "/join") {
@@ -161,17 +370,35 @@ void ClientApp::start() {
       pkt.type = JOIN_GAME;
       strcpy(pkt.gameName, gameName.c_str());
       sendPacket(pkt);
+    } else if (cmd == "/queue") {
+      if (inGame || queued) {
+        std::cout << "You are already in a game! Use /leave first.\n";
+        showMainMenu();
+        continue;
+      }
+      pkt.type = QUEUE;
+      sendPacket(pkt);
+      queued = true;
     } else if (cmd == "/list") {
+      std::string rest;
+      std::getline(std::cin, rest);
       if (inGame) {
         std::cout << "You are in a game! Use /leave first.\n";
         showGameMenu();
         continue;
       }
+      int page = 1;
+      std::istringstream(rest) >> page;
       pkt.type = GET_GAME_LIST;
+      pkt.x = page > 0 ? page - 1 : 0;
       sendPacket(pkt);
     } else if (cmd == "/stats") {
       pkt.type = GET_STATS;
       sendPacket(pkt);
+    } else if (cmd == "/metrics") {
+      // Not in the menu: only the server's --admin-login gets an answer.
+      pkt.type = ADMIN_METRICS;
+      sendPacket(pkt);
     } else if (cmd == "/shoot") {
       if (!inGame) {
         std::cout << "You are not in a game!\n";
@@ -181,8 +408,27 @@ void ClientApp::start() {
       pkt.type = SHOOT;
       std::cin >> pkt.x >> pkt.y;
       sendPacket(pkt);
+    } else if (cmd == "/board") {
+      if (!inGame) {
+        std::cout << "You are not in a game!\n";
+        showMainMenu();
+        continue;
+      }
+      pkt.type = GET_BOARD;
+      pkt.x = boards.left(BOARD_RADAR);
+      pkt.y = boards.top(BOARD_RADAR);
+      sendPacket(pkt);
+    } else if (cmd == "/view") {
+      if (!inGame) {
+        std::cout << "You are not in a game!\n";
+        showMainMenu();
+        continue;
+      }
+      pkt.type = GET_BOARD;
+      std::cin >> pkt.x >> pkt.y;
+      sendPacket(pkt);
     } else if (cmd == "/leave") {
-      if (!inGame && currentGame.empty()) {
+      if (!inGame && currentGame.empty() && !queued && !watching) {
         std::cout << "You are not in any game!\n";
         showMainMenu();
         continue;
@@ -190,8 +436,25 @@ void ClientApp::start() {
       pkt.type = LEAVE_GAME;
       sendPacket(pkt);
       inGame = false;
+      queued = false;
+      watching = false;
       currentGame = "";
+      pthread_mutex_lock(&output_mutex);
+      boards.release(output);
+      flushOutput();
+      pthread_mutex_unlock(&output_mutex);
       showMainMenu();
+    } else if (cmd == "/watch") {
+      if (inGame || queued) {
+        std::cout << "You are already in a game! Use /leave first.\n";
+        showMainMenu();
+        continue;
+      }
+      std::string target;
+      std::cin >> target;
+      pkt.type = SPECTATE;
+      strncpy(pkt.payload, target.c_str(), sizeof(pkt.payload) - 1);
+      sendPacket(pkt);
     } else {
       std::cout << "Invalid command.\n";
       if (inGame) {
@@ -204,4 +467,8 @@ void ClientApp::start() {
 
   pthread_cancel(listenerThread);
   pthread_join(listenerThread, NULL);
+  // The listener is gone, the screen needs no lock to be handed back.
+  boards.release(output);
+  flushOutput();
+  transport.close();
 }
\ No newline at end of file
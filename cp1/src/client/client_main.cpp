@@ -1,7 +1,33 @@
 #include "ClientApp.h"
 
-int main() {
-  ClientApp client;
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+
+int main(int argc, char *argv[]) {
+  std::string transportName = "fifo";
+  int shardCount = 1;
+  for (int i = 1; i < argc; ++i) {
+    if (strncmp(argv[i], "--transport=", 12) == 0) {
+      transportName = argv[i] + 12;
+    } else if (strncmp(argv[i], "--shards=", 9) == 0) {
+      shardCount = atoi(argv[i] + 9);
+    }
+  }
+
+  std::unique_ptr<ClientTransport> transport(
+      createClientTransport(transportName));
+  if (!transport) {
+    std::cerr << "Unknown transport '" << transportName
+              << "', expected fifo or shm." << std::endl;
+    return 1;
+  }
+
+  // A server that went away shows up as a failed write, not a signal.
+  std::signal(SIGPIPE, SIG_IGN);
+  ClientApp client(*transport, shardCount);
   client.start();
   return 0;
-}
\ No newline at end of file
+}
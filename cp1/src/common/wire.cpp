@@ -0,0 +1,315 @@
+#include "wire.h"
+
+#include <cstring>
+#include <unistd.h>
+
+static size_t putText(char *out, const char *text, size_t maxLen) {
+  size_t len = strnlen(text, maxLen);
+  memcpy(out, text, len);
+  return len;
+}
+
+static void getText(char *dst, size_t dstSize, const char *src, size_t len) {
+  if (len >= dstSize) {
+    len = dstSize - 1;
+  }
+  memcpy(dst, src, len);
+  dst[len] = '\0';
+}
+
+static size_t putCoords(char *out, int x, int y) {
+  int16_t coords[2] = {(int16_t)x, (int16_t)y};
+  memcpy(out, coords, sizeof(coords));
+  return sizeof(coords);
+}
+
+static void getCoords(const char *in, Packet &pkt) {
+  int16_t coords[2];
+  memcpy(coords, in, sizeof(coords));
+  pkt.x = coords[0];
+  pkt.y = coords[1];
+}
+
+size_t encodeFrame(const Packet &pkt, char *out) {
+  char *body = out + FRAME_HEADER_SIZE;
+  size_t length = 0;
+
+  switch (pkt.type) {
+  case LOGIN:
+    length = putText(body, pkt.sender, sizeof(pkt.sender) - 1);
+    break;
+  case CREATE_GAME:
+    body[0] = (char)pkt.x;
+    length = 1 + putText(body + 1, pkt.gameName, sizeof(pkt.gameName) - 1);
+    break;
+  case JOIN_GAME:
+    length = putText(body, pkt.gameName, sizeof(pkt.gameName) - 1);
+    break;
+  case SHOOT:
+    length = putCoords(body, pkt.x, pkt.y);
+    break;
+  case S_REDIRECT:
+    length = putCoords(body, pkt.x, pkt.y);
+    length += putText(body + length, pkt.payload, sizeof(pkt.payload) - 1);
+    break;
+  case GET_GAME_LIST: {
+    int16_t page = (int16_t)pkt.x;
+    memcpy(body, &page, sizeof(page));
+    length = sizeof(page);
+    break;
+  }
+  case S_SHOT_RESULT:
+    length = putCoords(body, pkt.x, pkt.y);
+    body[length++] = (char)pkt.shotResult;
+    length += putText(body + length, pkt.payload, sizeof(pkt.payload) - 1);
+    break;
+  case S_GAME_CREATED:
+  case S_ROOM_ADDED:
+  case S_ROOM_REMOVED:
+  case S_WATCHING: {
+    size_t nameLen = putText(body + 1, pkt.gameName, sizeof(pkt.gameName) - 1);
+    body[0] = (char)nameLen;
+    length = 1 + nameLen;
+    length += putText(body + length, pkt.payload, sizeof(pkt.payload) - 1);
+    break;
+  }
+  case S_BOARD: {
+    int side = viewportSide(pkt.y);
+    size_t cells = (size_t)side * side;
+    uint16_t size = (uint16_t)pkt.y;
+    body[0] = (char)pkt.x;
+    memcpy(body + 1, &size, sizeof(size));
+    length = 1 + sizeof(size) + putCoords(body + 1 + sizeof(size), pkt.left,
+                                          pkt.top);
+    memset(body + length, 0, (cells + 3) / 4);
+    for (size_t i = 0; i < cells; ++i) {
+      body[length + i / 4] |= (char)((pkt.payload[i] & 3) << (2 * (i % 4)));
+    }
+    length += (cells + 3) / 4;
+    break;
+  }
+  case S_BOARD_DELTA:
+    body[0] = (char)pkt.x;
+    body[1] = (char)pkt.y;
+    memcpy(body + 2, pkt.payload, CELL_UPDATE_SIZE * (size_t)pkt.y);
+    length = 2 + CELL_UPDATE_SIZE * (size_t)pkt.y;
+    break;
+  case GET_BOARD:
+    length = putCoords(body, pkt.x, pkt.y);
+    break;
+  case SPECTATE:
+  case S_MSG:
+  case S_GAME_LIST:
+  case S_GAME_START:
+  case S_GAME_OVER:
+  case S_STATS:
+  case S_LOGIN_ACK:
+  case S_METRICS:
+    length = putText(body, pkt.payload, sizeof(pkt.payload) - 1);
+    break;
+  default:
+    break;
+  }
+
+  FrameHeader header;
+  header.type = (uint8_t)pkt.type;
+  header.flags = 0;
+  header.length = (uint16_t)length;
+  header.session = pkt.session;
+  memcpy(out, &header, FRAME_HEADER_SIZE);
+
+  return FRAME_HEADER_SIZE + length;
+}
+
+bool decodeFrame(const char *frame, size_t size, Packet &pkt) {
+  if (size < FRAME_HEADER_SIZE) {
+    return false;
+  }
+
+  FrameHeader header;
+  memcpy(&header, frame, FRAME_HEADER_SIZE);
+  if (FRAME_HEADER_SIZE + header.length != size) {
+    return false;
+  }
+
+  pkt = Packet();
+  pkt.type = header.type;
+  pkt.session = header.session;
+
+  const char *body = frame + FRAME_HEADER_SIZE;
+  size_t length = header.length;
+
+  switch (pkt.type) {
+  case LOGIN:
+    getText(pkt.sender, sizeof(pkt.sender), body, length);
+    return length > 0;
+  case CREATE_GAME:
+    if (length < 1) {
+      return false;
+    }
+    pkt.x = (uint8_t)body[0];
+    getText(pkt.gameName, sizeof(pkt.gameName), body + 1, length - 1);
+    return true;
+  case JOIN_GAME:
+    getText(pkt.gameName, sizeof(pkt.gameName), body, length);
+    return true;
+  case SHOOT:
+    if (length != 2 * sizeof(int16_t)) {
+      return false;
+    }
+    getCoords(body, pkt);
+    return true;
+  case S_REDIRECT:
+    if (length < 2 * sizeof(int16_t)) {
+      return false;
+    }
+    getCoords(body, pkt);
+    getText(pkt.payload, sizeof(pkt.payload), body + 2 * sizeof(int16_t),
+            length - 2 * sizeof(int16_t));
+    return true;
+  case S_SHOT_RESULT:
+    if (length < 2 * sizeof(int16_t) + 1) {
+      return false;
+    }
+    getCoords(body, pkt);
+    pkt.shotResult = (uint8_t)body[2 * sizeof(int16_t)];
+    getText(pkt.payload, sizeof(pkt.payload), body + 2 * sizeof(int16_t) + 1,
+            length - 2 * sizeof(int16_t) - 1);
+    return true;
+  case GET_GAME_LIST: {
+    int16_t page;
+    if (length != sizeof(page)) {
+      return false;
+    }
+    memcpy(&page, body, sizeof(page));
+    pkt.x = page;
+    return true;
+  }
+  case S_GAME_CREATED:
+  case S_ROOM_ADDED:
+  case S_ROOM_REMOVED:
+  case S_WATCHING: {
+    if (length < 1) {
+      return false;
+    }
+    size_t nameLen = (uint8_t)body[0];
+    if (1 + nameLen > length) {
+      return false;
+    }
+    getText(pkt.gameName, sizeof(pkt.gameName), body + 1, nameLen);
+    getText(pkt.payload, sizeof(pkt.payload), body + 1 + nameLen,
+            length - 1 - nameLen);
+    return true;
+  }
+  case S_BOARD: {
+    const size_t header = 1 + sizeof(uint16_t) + 2 * sizeof(int16_t);
+    if (length < header) {
+      return false;
+    }
+    uint16_t size;
+    memcpy(&size, body + 1, sizeof(size));
+    pkt.x = (uint8_t)body[0];
+    pkt.y = size;
+    int16_t origin[2];
+    memcpy(origin, body + 1 + sizeof(size), sizeof(origin));
+    pkt.left = origin[0];
+    pkt.top = origin[1];
+    int side = viewportSide(pkt.y);
+    size_t cells = (size_t)side * side;
+    if (cells > sizeof(pkt.payload) || length != header + (cells + 3) / 4) {
+      return false;
+    }
+    for (size_t i = 0; i < cells; ++i) {
+      pkt.payload[i] = (char)((body[header + i / 4] >> (2 * (i % 4))) & 3);
+    }
+    return true;
+  }
+  case S_BOARD_DELTA:
+    if (length < 2) {
+      return false;
+    }
+    pkt.x = (uint8_t)body[0];
+    pkt.y = (uint8_t)body[1];
+    if (CELL_UPDATE_SIZE * (size_t)pkt.y > sizeof(pkt.payload) ||
+        length != 2 + CELL_UPDATE_SIZE * (size_t)pkt.y) {
+      return false;
+    }
+    memcpy(pkt.payload, body + 2, CELL_UPDATE_SIZE * (size_t)pkt.y);
+    return true;
+  case GET_BOARD:
+    if (length != 2 * sizeof(int16_t)) {
+      return false;
+    }
+    getCoords(body, pkt);
+    return true;
+  case SPECTATE:
+  case S_MSG:
+  case S_GAME_LIST:
+  case S_GAME_START:
+  case S_GAME_OVER:
+  case S_STATS:
+  case S_LOGIN_ACK:
+  case S_METRICS:
+    getText(pkt.payload, sizeof(pkt.payload), body, length);
+    return true;
+  case LEAVE_GAME:
+  case LOGOUT:
+  case GET_STATS:
+  case ADMIN_METRICS:
+  case QUEUE:
+  case HEARTBEAT:
+    return length == 0;
+  default:
+    return false;
+  }
+}
+
+FrameReader::FrameReader(size_t capacity)
+    : buffer(capacity > MAX_FRAME_SIZE ? capacity : MAX_FRAME_SIZE), start(0),
+      end(0) {}
+
+char *FrameReader::reserve(size_t &available) {
+  if (start > 0) {
+    memmove(buffer.data(), buffer.data() + start, end - start);
+    end -= start;
+    start = 0;
+  }
+  available = buffer.size() - end;
+  return buffer.data() + end;
+}
+
+ssize_t FrameReader::fill(int fd) {
+  size_t available;
+  char *space = reserve(available);
+  ssize_t n = read(fd, space, available);
+  if (n > 0) {
+    commit(n);
+  }
+  return n;
+}
+
+bool FrameReader::next(Packet &pkt) {
+  while (end - start >= FRAME_HEADER_SIZE) {
+    FrameHeader header;
+    memcpy(&header, buffer.data() + start, FRAME_HEADER_SIZE);
+
+    if (header.length > MAX_FRAME_BODY) {
+      // There is no way to find the next frame boundary after a corrupt
+      // header, so everything buffered so far is discarded.
+      start = end = 0;
+      return false;
+    }
+
+    size_t frameSize = FRAME_HEADER_SIZE + header.length;
+    if (end - start < frameSize) {
+      return false;
+    }
+
+    const char *frame = buffer.data() + start;
+    start += frameSize;
+    if (decodeFrame(frame, frameSize, pkt)) {
+      return true;
+    }
+  }
+  return false;
+}
@@ -1,115 +1,213 @@
 #include "GameLogic.h"
 
-#include <cstdio>
-#include <cstdlib>
 #include <cstring>
-#include <ctime>
 
-GameBoard::GameBoard() {
-  shipsAlive = 0;
-  for (int i = 0; i < SIZE; ++i) {
-    for (int j = 0; j < SIZE; ++j) {
-      grid[i][j] = EMPTY;
-    }
-  }
+// Rather than falling back to touching ships, a no-touching fleet that ran
+// into a dead end is started over from scratch; this bounds the retries.
+static const int MAX_PLACEMENT_ATTEMPTS = 64;
+
+template <typename Mask> static Mask cellBit(int index) {
+  return Mask(1) << index;
 }
 
-void GameBoard::placeShipsRandomly() {
-  static const int BATTLESHIP = 4;
-  static const int CRUISER = 3;
-  static const int DESTROYER = 2;
-  static const int SUBMARINE = 1;
+// Every (orientation, length, origin) mask of a board variant and its halo
+// (the mask grown by one cell in all eight directions), built once on first
+// use.
+template <typename Board> struct PlacementTable {
+  typedef typename Board::Mask Mask;
+  static const int SIZE = Board::SIZE;
+  static const int CELLS = Board::CELLS;
+
+  Mask masks[2][Board::MAX_SHIP_LENGTH + 1][CELLS];
+  Mask halos[2][Board::MAX_SHIP_LENGTH + 1][CELLS];
+
+  PlacementTable() {
+    for (int horizontal = 0; horizontal < 2; ++horizontal) {
+      for (int len = 0; len <= Board::MAX_SHIP_LENGTH; ++len) {
+        for (int origin = 0; origin < CELLS; ++origin) {
+          int row = origin / SIZE;
+          int col = origin % SIZE;
+          Mask mask = 0;
+          if (len > 0 && (horizontal ? col : row) + len <= SIZE) {
+            for (int k = 0; k < len; ++k) {
+              mask |= cellBit<Mask>(origin + (horizontal ? k : k * SIZE));
+            }
+          }
+          masks[horizontal][len][origin] = mask;
+          halos[horizontal][len][origin] = grow(mask);
+        }
+      }
+    }
+  }
 
-  for (int i = 0; i < SIZE; ++i) {
-    for (int j = 0; j < SIZE; ++j) {
-      grid[i][j] = EMPTY;
+  static Mask grow(Mask mask) {
+    Mask firstColumn = 0;
+    Mask board = 0;
+    for (int row = 0; row < SIZE; ++row) {
+      firstColumn |= cellBit<Mask>(row * SIZE);
+    }
+    for (int cell = 0; cell < CELLS; ++cell) {
+      board |= cellBit<Mask>(cell);
     }
+    Mask lastColumn = firstColumn << (SIZE - 1);
+
+    Mask wide = mask | ((mask << 1) & ~firstColumn) |
+                ((mask >> 1) & ~lastColumn);
+    return (wide | (wide << SIZE) | (wide >> SIZE)) & board;
   }
-  shipsAlive = 0;
-
-  int ships[] = {BATTLESHIP, CRUISER,   CRUISER,   DESTROYER, DESTROYER,
-                 DESTROYER,  SUBMARINE, SUBMARINE, SUBMARINE, SUBMARINE};
-
-  for (int len : ships) {
-    bool placed = false;
-    while (!placed) {
-      int row = std::rand() % SIZE;
-      int col = std::rand() % SIZE;
-      bool horizontal = std::rand() % 2;
-
-      bool canPlace = true;
-      for (int k = 0; k < len; ++k) {
-        int nrow = row + (horizontal ? 0 : k);
-        int ncol = col + (horizontal ? k : 0);
-
-        if (nrow >= SIZE || ncol >= SIZE || grid[nrow][ncol] != EMPTY) {
-          canPlace = false;
-          break;
-        }
-      }
+};
+
+template <typename Board> static const PlacementTable<Board> &placementTable() {
+  static const PlacementTable<Board> table;
+  return table;
+}
+
+template <int Size, typename Fleet>
+typename GameBoard<Size, Fleet>::Mask
+GameBoard<Size, Fleet>::placementMask(int origin, int length,
+                                      bool horizontal) {
+  if (length < 1 || length > MAX_SHIP_LENGTH || origin < 0 ||
+      origin >= CELLS) {
+    return 0;
+  }
+  return placementTable<GameBoard>().masks[horizontal][length][origin];
+}
+
+template <int Size, typename Fleet>
+typename GameBoard<Size, Fleet>::Mask GameBoard<Size, Fleet>::halo(Mask mask) {
+  return PlacementTable<GameBoard>::grow(mask);
+}
+
+template <int Size, typename Fleet> GameBoard<Size, Fleet>::GameBoard() {
+  clear();
+}
 
-      if (canPlace) {
-        for (int k = 0; k < len; ++k) {
-          int nrow = row + (horizontal ? 0 : k);
-          int ncol = col + (horizontal ? k : 0);
-          grid[nrow][ncol] = SHIP;
-          shipsAlive++;
+template <int Size, typename Fleet> void GameBoard<Size, Fleet>::clear() {
+  ships = 0;
+  hits = 0;
+  misses = 0;
+  shipCount = 0;
+}
+
+template <int Size, typename Fleet>
+bool GameBoard<Size, Fleet>::tryPlaceFleet(Xoshiro256 &rng, bool noTouching) {
+  const PlacementTable<GameBoard> &table = placementTable<GameBoard>();
+  Mask blocked = 0;
+
+  for (int len : FLEET) {
+    // Candidates are encoded as origin * 2 + horizontal.
+    uint16_t candidates[2 * CELLS];
+    int count = 0;
+    for (int origin = 0; origin < CELLS; ++origin) {
+      for (int horizontal = 0; horizontal < 2; ++horizontal) {
+        const Mask &mask = table.masks[horizontal][len][origin];
+        if (mask != 0 && (mask & blocked) == 0) {
+          candidates[count++] = (uint16_t)(origin * 2 + horizontal);
         }
-        placed = true;
       }
     }
+    if (count == 0) {
+      return false;
+    }
+
+    int pick = candidates[rng.below(count)];
+    int origin = pick / 2;
+    bool horizontal = pick % 2;
+    ships |= table.masks[horizontal][len][origin];
+    blocked |= noTouching ? table.halos[horizontal][len][origin]
+                          : table.masks[horizontal][len][origin];
+    fleet[shipCount++] = ShipPlacement{(uint16_t)origin, (uint8_t)len,
+                                       horizontal};
+  }
+  return true;
+}
+
+template <int Size, typename Fleet>
+void GameBoard<Size, Fleet>::placeShips(Xoshiro256 &rng, bool noTouching) {
+  for (int attempt = 0; attempt < MAX_PLACEMENT_ATTEMPTS; ++attempt) {
+    clear();
+    if (tryPlaceFleet(rng, noTouching)) {
+      return;
+    }
   }
+  clear();
+  tryPlaceFleet(rng, false);
 }
 
-ShotResult GameBoard::processShot(int x, int y) {
+template <int Size, typename Fleet>
+ShotResult GameBoard<Size, Fleet>::processShot(int x, int y) {
   if (x < 0 || x >= SIZE || y < 0 || y >= SIZE)
     return RES_REPEAT;
 
-  int &cell = grid[y][x];
+  Mask bit = cellBit<Mask>(y * SIZE + x);
 
-  if (cell == MISS || cell == HIT)
+  if (((hits | misses) & bit) != 0)
     return RES_REPEAT;
 
-  if (cell == EMPTY) {
-    cell = MISS;
+  if ((ships & bit) == 0) {
+    misses |= bit;
     return RES_MISS;
   }
 
-  if (cell == SHIP) {
-    cell = HIT;
-    shipsAlive--;
-    if (shipsAlive <= 0)
-      return RES_LOSE;
-    return RES_HIT;
+  hits |= bit;
+  if ((ships & ~hits) == 0)
+    return RES_LOSE;
+
+  for (int i = 0; i < shipCount; ++i) {
+    const ShipPlacement &ship = fleet[i];
+    Mask mask = placementMask(ship.origin, ship.length, ship.horizontal);
+    if ((mask & bit) != 0) {
+      return (mask & ~hits) == 0 ? RES_SUNK : RES_HIT;
+    }
   }
+  return RES_HIT;
+}
 
-  return RES_REPEAT;
+template <int Size, typename Fleet>
+int GameBoard<Size, Fleet>::getCell(int x, int y) const {
+  Mask bit = cellBit<Mask>(y * SIZE + x);
+  if ((hits & bit) != 0)
+    return HIT;
+  if ((misses & bit) != 0)
+    return MISS;
+  if ((ships & bit) != 0)
+    return SHIP;
+  return EMPTY;
 }
 
-void GameBoard::getBoardString(char *buffer, bool showShips) {
-  int pos = 0;
-
-  pos += sprintf(buffer + pos, "  0 1 2 3 4 5 6 7 8 9\n");
-  pos += sprintf(buffer + pos, " ---------------------\n");
-
-  for (int i = 0; i < SIZE; ++i) {
-    pos += sprintf(buffer + pos, "%d ", i);
-    for (int j = 0; j < SIZE; ++j) {
-      char symbol = '.';
-      int cell = grid[i][j];
-
-      if (cell == EMPTY) {
-        symbol = '.';
-      } else if (cell == SHIP) {
-        symbol = showShips ? '#' : '.';
-      } else if (cell == MISS) {
-        symbol = '*';
-      } else if (cell == HIT) {
-        symbol = 'X';
-      }
-      pos += sprintf(buffer + pos, "%c ", symbol);
+template <int Size, typename Fleet>
+void GameBoard<Size, Fleet>::getSnapshot(char *cells, bool showShips) const {
+  memset(cells, EMPTY, CELLS);
+
+  // Hits are written last since they overwrite the ship cells.
+  const Mask layers[] = {showShips ? ships : Mask(0), misses, hits};
+  const char states[] = {SHIP, MISS, HIT};
+  for (int layer = 0; layer < 3; ++layer) {
+    for (Mask m = layers[layer]; m != 0; clearLowestBit(m)) {
+      cells[lowestBit(m)] = states[layer];
+    }
+  }
+}
+
+template <int Size, typename Fleet>
+void GameBoard<Size, Fleet>::getViewport(int left, int top, int side,
+                                         char *cells, bool showShips) const {
+  if (left == 0 && top == 0 && side == SIZE) {
+    getSnapshot(cells, showShips);
+    return;
+  }
+  for (int row = 0; row < side; ++row) {
+    for (int col = 0; col < side; ++col) {
+      int x = left + col;
+      int y = top + row;
+      int state = x >= 0 && x < SIZE && y >= 0 && y < SIZE ? getCell(x, y)
+                                                            : EMPTY;
+      cells[row * side + col] = (char)(state == SHIP && !showShips ? EMPTY
+                                                                   : state);
     }
-    pos += sprintf(buffer + pos, "\n");
   }
-  buffer[pos] = '\0';
-}
\ No newline at end of file
+}
+
+template class GameBoard<BOARD_MODE_SIZES[MODE_CLASSIC], ClassicFleet>;
+template class GameBoard<BOARD_MODE_SIZES[MODE_LARGE], LargeFleet>;
+template class GameBoard<BOARD_MODE_SIZES[MODE_HUGE], HugeFleet>;
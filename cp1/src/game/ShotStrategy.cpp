@@ -0,0 +1,252 @@
+#include "ShotStrategy.h"
+
+#include <algorithm>
+
+static const BoardMask ONE = 1;
+static const int SIZE = ClassicBoard::SIZE;
+static const int CELLS = ShotStrategy::CELLS;
+
+static int popcount(BoardMask mask) {
+  return __builtin_popcountll((uint64_t)mask) +
+         __builtin_popcountll((uint64_t)(mask >> 64));
+}
+
+struct BoardShifts {
+  BoardMask board;
+  BoardMask firstColumn;
+  BoardMask lastColumn;
+  // Cells with (x + y) even.
+  BoardMask checkerboard;
+
+  BoardShifts() : board((ONE << CELLS) - 1), firstColumn(0), checkerboard(0) {
+    for (int row = 0; row < SIZE; ++row) {
+      firstColumn |= ONE << (row * SIZE);
+    }
+    lastColumn = firstColumn << (SIZE - 1);
+    for (int cell = 0; cell < CELLS; ++cell) {
+      if ((cell / SIZE + cell % SIZE) % 2 == 0) {
+        checkerboard |= ONE << cell;
+      }
+    }
+  }
+
+  BoardMask horizontalNeighbours(BoardMask m) const {
+    return ((m << 1) & ~firstColumn) | ((m >> 1) & ~lastColumn);
+  }
+  BoardMask verticalNeighbours(BoardMask m) const {
+    return ((m << SIZE) | (m >> SIZE)) & board;
+  }
+};
+
+static const BoardShifts &shifts() {
+  static const BoardShifts table;
+  return table;
+}
+
+// Every distinct placement of each ship length, so the density scan walks a
+// flat array instead of probing every origin and orientation.
+struct PlacementList {
+  BoardMask masks[ClassicBoard::MAX_SHIP_LENGTH + 1][2 * CELLS];
+  int count[ClassicBoard::MAX_SHIP_LENGTH + 1];
+
+  PlacementList() {
+    for (int len = 0; len <= ClassicBoard::MAX_SHIP_LENGTH; ++len) {
+      count[len] = 0;
+      for (int origin = 0; origin < CELLS; ++origin) {
+        // A single cell is the same placement either way round.
+        for (int horizontal = 0; horizontal < (len > 1 ? 2 : 1);
+             ++horizontal) {
+          BoardMask mask = ClassicBoard::placementMask(origin, len, horizontal);
+          if (mask != 0) {
+            masks[len][count[len]++] = mask;
+          }
+        }
+      }
+    }
+  }
+};
+
+static const PlacementList &placements() {
+  static const PlacementList list;
+  return list;
+}
+
+void ShotStrategy::reset(Xoshiro256 &, bool noTouching) {
+  this->noTouching = noTouching;
+  tried = 0;
+  openHits = 0;
+  excluded = 0;
+  std::fill(afloat, afloat + ClassicBoard::MAX_SHIP_LENGTH + 1, 0);
+  for (int len : ClassicBoard::FLEET) {
+    afloat[len]++;
+  }
+}
+
+void ShotStrategy::onResult(int cell, ShotResult result) {
+  BoardMask bit = ONE << cell;
+  tried |= bit;
+  switch (result) {
+  case RES_MISS:
+    excluded |= bit;
+    break;
+  case RES_HIT:
+    openHits |= bit;
+    break;
+  case RES_SUNK:
+  case RES_LOSE:
+    openHits |= bit;
+    markSunk(cell);
+    break;
+  default:
+    break;
+  }
+}
+
+void ShotStrategy::markSunk(int cell) {
+  // The sunk ship is the straight run of unresolved hits through cell.
+  const BoardShifts &s = shifts();
+  BoardMask ship = ONE << cell;
+  for (BoardMask grown = ship;; ship = grown) {
+    grown = ship | (s.horizontalNeighbours(ship) & openHits);
+    if (grown == ship) {
+      break;
+    }
+  }
+  if (ship == (ONE << cell)) {
+    for (BoardMask grown = ship;; ship = grown) {
+      grown = ship | (s.verticalNeighbours(ship) & openHits);
+      if (grown == ship) {
+        break;
+      }
+    }
+  }
+
+  openHits &= ~ship;
+  int len = std::min(popcount(ship), (int)ClassicBoard::MAX_SHIP_LENGTH);
+  if (afloat[len] > 0) {
+    afloat[len]--;
+  }
+  if (noTouching) {
+    excluded |= ClassicBoard::halo(ship) & ~ship;
+  }
+}
+
+int ShotStrategy::anyUntried() const {
+  BoardMask untried = shifts().board & ~tried;
+  return untried != 0 ? lowestBit(untried) : 0;
+}
+
+int ShotStrategy::pickBit(BoardMask mask, Xoshiro256 &rng) {
+  for (int skip = rng.below(popcount(mask)); skip > 0; --skip) {
+    mask &= mask - 1;
+  }
+  return lowestBit(mask);
+}
+
+void RandomStrategy::reset(Xoshiro256 &rng, bool noTouching) {
+  ShotStrategy::reset(rng, noTouching);
+  for (int i = 0; i < CELLS; ++i) {
+    order[i] = i;
+  }
+  for (int i = CELLS - 1; i > 0; --i) {
+    std::swap(order[i], order[rng.below(i + 1)]);
+  }
+  nextIndex = 0;
+}
+
+int RandomStrategy::next(Xoshiro256 &) {
+  while (nextIndex < CELLS && (tried & (ONE << order[nextIndex]))) {
+    ++nextIndex;
+  }
+  return nextIndex < CELLS ? order[nextIndex] : anyUntried();
+}
+
+int HuntTargetStrategy::next(Xoshiro256 &rng) {
+  const BoardShifts &s = shifts();
+  BoardMask open = s.board & ~tried & ~excluded;
+
+  if (openHits != 0) {
+    // Two adjacent hits give the ship's direction.
+    BoardMask alongRow = openHits & s.horizontalNeighbours(openHits);
+    BoardMask alongColumn = openHits & s.verticalNeighbours(openHits);
+    BoardMask targets;
+    if (alongRow != 0) {
+      targets = s.horizontalNeighbours(alongRow) & open;
+    } else if (alongColumn != 0) {
+      targets = s.verticalNeighbours(alongColumn) & open;
+    } else {
+      targets = (s.horizontalNeighbours(openHits) |
+                 s.verticalNeighbours(openHits)) &
+                open;
+    }
+    if (targets != 0) {
+      return pickBit(targets, rng);
+    }
+  }
+
+  // Every ship of length two or more covers a checkerboard cell; single
+  // cells are only hunted once those ships are gone.
+  bool longShipsAfloat = false;
+  for (int len = 2; len <= ClassicBoard::MAX_SHIP_LENGTH; ++len) {
+    longShipsAfloat = longShipsAfloat || afloat[len] > 0;
+  }
+  BoardMask hunt = longShipsAfloat ? open & s.checkerboard : open;
+  if (hunt == 0) {
+    hunt = open;
+  }
+  return hunt != 0 ? pickBit(hunt, rng) : anyUntried();
+}
+
+int DensityStrategy::next(Xoshiro256 &rng) {
+  const PlacementList &list = placements();
+  // Sunk ship cells are tried but no longer open hits.
+  BoardMask blocked = excluded | (tried & ~openHits);
+  int weights[CELLS] = {};
+
+  for (int len = 1; len <= ClassicBoard::MAX_SHIP_LENGTH; ++len) {
+    if (afloat[len] == 0) {
+      continue;
+    }
+    for (int i = 0; i < list.count[len]; ++i) {
+      BoardMask mask = list.masks[len][i];
+      if ((mask & blocked) != 0) {
+        continue;
+      }
+      int weight = afloat[len];
+      if ((mask & openHits) != 0) {
+        weight *= 1 + HIT_WEIGHT * popcount(mask & openHits);
+      }
+      for (BoardMask m = mask & ~tried; m != 0; m &= m - 1) {
+        weights[lowestBit(m)] += weight;
+      }
+    }
+  }
+
+  int best = -1;
+  int bestWeight = 0;
+  int ties = 0;
+  for (int cell = 0; cell < CELLS; ++cell) {
+    if (weights[cell] > bestWeight) {
+      best = cell;
+      bestWeight = weights[cell];
+      ties = 1;
+    } else if (weights[cell] == bestWeight && bestWeight > 0 &&
+               rng.below(++ties) == 0) {
+      best = cell;
+    }
+  }
+  return best >= 0 ? best : anyUntried();
+}
+
+ShotStrategy *createShotStrategy(const std::string &name) {
+  if (name == "random") {
+    return new RandomStrategy();
+  }
+  if (name == "hunt") {
+    return new HuntTargetStrategy();
+  }
+  if (name == "density") {
+    return new DensityStrategy();
+  }
+  return nullptr;
+}
@@ -0,0 +1,115 @@
+#include "SparseBoard.h"
+
+#include <algorithm>
+
+// Random spots tried per ship before touching ships are allowed, and then
+// before the ship is given up on. A sparse board is mostly water, so nearly
+// every first try fits.
+static const int MAX_PLACEMENT_TRIES = 256;
+
+SparseBoard::SparseBoard(int size, const int *lengths, int count, int copies)
+    : boardSize(size < 1 ? 1 : size > MAX_SIZE ? MAX_SIZE : size),
+      cellsAfloat(0) {
+  size_t fleetCells = 0;
+  for (int copy = 0; copy < copies; ++copy) {
+    for (int i = 0; i < count; ++i) {
+      fleet.push_back((uint8_t)lengths[i]);
+      fleetCells += lengths[i];
+    }
+  }
+  // Placed longest first across all the copies.
+  std::sort(fleet.begin(), fleet.end(), std::greater<uint8_t>());
+  ships.reserve(fleet.size());
+  shipCells.reserve(fleetCells);
+}
+
+bool SparseBoard::fits(int x, int y, int length, bool horizontal,
+                       bool noTouching) const {
+  int right = horizontal ? x + length - 1 : x;
+  int bottom = horizontal ? y : y + length - 1;
+  if (x < 0 || y < 0 || right >= boardSize || bottom >= boardSize) {
+    return false;
+  }
+
+  int margin = noTouching ? 1 : 0;
+  for (int row = y - margin; row <= bottom + margin; ++row) {
+    for (int col = x - margin; col <= right + margin; ++col) {
+      if (row >= 0 && row < boardSize && col >= 0 && col < boardSize &&
+          shipCells.find(cellOf(col, row))) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+void SparseBoard::addShip(int x, int y, int length, bool horizontal) {
+  uint32_t index = (uint32_t)ships.size();
+  ships.push_back(Ship{cellOf(x, y), (uint8_t)length, horizontal, 0});
+  for (int k = 0; k < length; ++k) {
+    shipCells.insert(horizontal ? cellOf(x + k, y) : cellOf(x, y + k), index);
+  }
+  cellsAfloat += length;
+}
+
+void SparseBoard::placeShips(Xoshiro256 &rng, bool noTouching) {
+  for (int length : fleet) {
+    if (length > boardSize) {
+      continue;
+    }
+    bool placed = false;
+    for (int pass = noTouching ? 0 : 1; pass < 2 && !placed; ++pass) {
+      for (int tries = 0; tries < MAX_PLACEMENT_TRIES && !placed; ++tries) {
+        bool horizontal = rng.below(2) != 0;
+        int span = boardSize - length + 1;
+        int x = (int)rng.below(horizontal ? span : boardSize);
+        int y = (int)rng.below(horizontal ? boardSize : span);
+        if (fits(x, y, length, horizontal, pass == 0)) {
+          addShip(x, y, length, horizontal);
+          placed = true;
+        }
+      }
+    }
+  }
+}
+
+ShotResult SparseBoard::processShot(int x, int y) {
+  if (x < 0 || x >= boardSize || y < 0 || y >= boardSize)
+    return RES_REPEAT;
+
+  uint32_t cell = cellOf(x, y);
+  if (!shots.insert(cell))
+    return RES_REPEAT;
+
+  const uint32_t *index = shipCells.find(cell);
+  if (!index)
+    return RES_MISS;
+
+  Ship &ship = ships[*index];
+  ++ship.hits;
+  if (--cellsAfloat == 0)
+    return RES_LOSE;
+  return ship.hits == ship.length ? RES_SUNK : RES_HIT;
+}
+
+int SparseBoard::getCell(int x, int y) const {
+  if (x < 0 || x >= boardSize || y < 0 || y >= boardSize)
+    return EMPTY;
+
+  uint32_t cell = cellOf(x, y);
+  bool ship = shipCells.find(cell) != nullptr;
+  if (shots.contains(cell))
+    return ship ? HIT : MISS;
+  return ship ? SHIP : EMPTY;
+}
+
+void SparseBoard::getViewport(int left, int top, int side, char *cells,
+                              bool showShips) const {
+  for (int row = 0; row < side; ++row) {
+    for (int col = 0; col < side; ++col) {
+      int state = getCell(left + col, top + row);
+      cells[row * side + col] = (char)(state == SHIP && !showShips ? EMPTY
+                                                                   : state);
+    }
+  }
+}
@@ -0,0 +1,402 @@
+#include "LoadGen.h"
+#include "GameLogic.h"
+#include "ShotStrategy.h"
+
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <sstream>
+#include <unistd.h>
+
+static const char *LATENCY_NAMES[LAT_KINDS] = {"login", "create", "join",
+                                               "queue", "shoot"};
+
+static uint64_t nowNs() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+LoadGen::LoadGen(const LoadGenOptions &options)
+    : options(options), elapsedSec(0), timedOut(false), deadlineNs(0) {}
+
+bool LoadGen::send(Bot &bot, Packet &pkt) {
+  pkt.session = bot.sessionId;
+  char frame[MAX_FRAME_SIZE];
+  size_t frameSize = encodeFrame(pkt, frame);
+  return bot.transport->send(frame, frameSize);
+}
+
+bool LoadGen::receive(Bot &bot, Packet &pkt) {
+  while (!bot.reader.next(pkt)) {
+    if (nowNs() > deadlineNs) {
+      return false;
+    }
+    if (bot.transport->receive(bot.reader) < 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool LoadGen::request(Bot &bot, Packet &pkt, int expect, LatencyKind kind) {
+  uint64_t start = nowNs();
+  if (!send(bot, pkt)) {
+    return false;
+  }
+
+  Packet resp;
+  while (receive(bot, resp)) {
+    if (resp.type == expect) {
+      bot.latencies[kind].push_back(nowNs() - start);
+      if (resp.session != 0) {
+        bot.sessionId = resp.session;
+      }
+      pkt = resp;
+      return true;
+    }
+    if (resp.type == S_REDIRECT) {
+      if (!follow(bot, resp)) {
+        return false;
+      }
+      if (pkt.type == LOGIN) {
+        return true;
+      }
+      if (!send(bot, pkt)) {
+        return false;
+      }
+      continue;
+    }
+    if (resp.type == S_MSG) {
+      std::cerr << "[" << bot.login << "] " << resp.payload << std::endl;
+      bot.errors++;
+      return false;
+    }
+  }
+  return false;
+}
+
+bool LoadGen::follow(Bot &bot, const Packet &redirect) {
+  if (bot.sessionId != 0) {
+    Packet logout;
+    logout.type = LOGOUT;
+    send(bot, logout);
+  }
+  bot.transport->close();
+  bot.reader.clear();
+  bot.sessionId = 0;
+
+  bot.transport->setShard(redirect.x);
+  if (!bot.transport->open(bot.login)) {
+    std::cerr << "[" << bot.login << "] Unable to connect to shard "
+              << redirect.x << std::endl;
+    return false;
+  }
+  Packet login;
+  login.type = LOGIN;
+  strncpy(login.sender, bot.login.c_str(), sizeof(login.sender) - 1);
+  return request(bot, login, S_LOGIN_ACK, LAT_LOGIN);
+}
+
+bool LoadGen::waitForMatch(Bot &bot, Packet &start, bool &matched) {
+  matched = false;
+  uint64_t sent = nowNs();
+  Packet queue;
+  queue.type = QUEUE;
+  if (!send(bot, queue)) {
+    return false;
+  }
+
+  while (true) {
+    if (bot.reader.next(start)) {
+      if (start.type == S_GAME_START) {
+        bot.latencies[LAT_QUEUE].push_back(nowNs() - sent);
+        gameStarts++;
+        matched = true;
+        return true;
+      }
+      if (start.type == S_REDIRECT) {
+        // Either matched on another shard, whose game starts on login, or
+        // sent home after a game there.
+        bool toMatch = start.y == REDIRECT_MATCH;
+        if (!follow(bot, start) || (!toMatch && !send(bot, queue))) {
+          return false;
+        }
+        continue;
+      }
+      if (start.type == S_MSG && strncmp(start.payload, "Looking", 7) != 0 &&
+          strncmp(start.payload, "Opponent found", 14) != 0) {
+        std::cerr << "[" << bot.login << "] " << start.payload << std::endl;
+        bot.errors++;
+        return false;
+      }
+      continue;
+    }
+    // Everyone else is done, nobody is left to match with. The logout that
+    // follows also takes the bot out of the queue, or ends a game it was
+    // matched into meanwhile.
+    if (gameStarts.load() >= 2 * totalGames) {
+      return true;
+    }
+    if (nowNs() > deadlineNs || bot.transport->receive(bot.reader) < 0) {
+      return false;
+    }
+  }
+}
+
+bool LoadGen::enterRoom(Bot &bot, int game, Packet &start) {
+  std::string room = bot.pair->roomPrefix + std::to_string(game);
+
+  if (bot.creator) {
+    Packet create;
+    create.type = CREATE_GAME;
+    strncpy(create.gameName, room.c_str(), sizeof(create.gameName) - 1);
+    if (!request(bot, create, S_GAME_CREATED, LAT_CREATE)) {
+      return false;
+    }
+    bot.pair->roomsCreated.store(game + 1);
+    do {
+      if (!receive(bot, start)) {
+        return false;
+      }
+    } while (start.type != S_GAME_START);
+  } else {
+    while (bot.pair->roomsCreated.load() <= game) {
+      if (nowNs() > deadlineNs) {
+        return false;
+      }
+      usleep(100);
+    }
+    start.type = JOIN_GAME;
+    strncpy(start.gameName, room.c_str(), sizeof(start.gameName) - 1);
+    if (!request(bot, start, S_GAME_START, LAT_JOIN)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool LoadGen::playGame(Bot &bot, int game, const Packet &start) {
+  // Assumes the server's default no-touching fleets; the strategy still
+  // finishes the game if they do touch.
+  Xoshiro256 rng(bot.seed + game);
+  bot.strategy->reset(rng, true);
+  bool myTurn = strstr(start.payload, "YOUR TURN") != nullptr;
+
+  Packet pkt;
+  while (true) {
+    if (!myTurn) {
+      if (!receive(bot, pkt)) {
+        return false;
+      }
+      if (pkt.type == S_SHOT_RESULT && pkt.shotResult == RES_MISS) {
+        myTurn = true;
+      } else if (pkt.type == S_GAME_OVER) {
+        bot.gamesFinished++;
+        return true;
+      }
+      continue;
+    }
+
+    int cell = bot.strategy->next(rng);
+    Packet shot;
+    shot.type = SHOOT;
+    shot.x = cell % ClassicBoard::SIZE;
+    shot.y = cell / ClassicBoard::SIZE;
+    uint64_t sent = nowNs();
+    if (!send(bot, shot)) {
+      return false;
+    }
+
+    while (true) {
+      if (!receive(bot, pkt)) {
+        return false;
+      }
+      if (pkt.type == S_SHOT_RESULT || pkt.type == S_GAME_OVER ||
+          pkt.type == S_MSG) {
+        break;
+      }
+    }
+    bot.latencies[LAT_SHOOT].push_back(nowNs() - sent);
+    bot.moves++;
+
+    if (pkt.type == S_GAME_OVER) {
+      bot.gamesFinished++;
+      return true;
+    }
+    if (pkt.type == S_MSG) {
+      // Out of turn; the opponent's result will hand the turn back.
+      bot.errors++;
+      myTurn = false;
+      continue;
+    }
+    bot.strategy->onResult(cell, (ShotResult)pkt.shotResult);
+    myTurn = pkt.shotResult != RES_MISS;
+  }
+}
+
+bool LoadGen::runBot(Bot &bot) {
+  bot.transport->setShard(loginShard(bot.login, options.shards));
+  if (!bot.transport->open(bot.login)) {
+    std::cerr << "[" << bot.login << "] Unable to connect" << std::endl;
+    return false;
+  }
+
+  Packet login;
+  login.type = LOGIN;
+  strncpy(login.sender, bot.login.c_str(), sizeof(login.sender) - 1);
+  bool ok = request(bot, login, S_LOGIN_ACK, LAT_LOGIN);
+
+  if (options.queue) {
+    // Matches are random, so bots keep queueing until the run has started
+    // as many games as the room mode would.
+    for (int game = 0; ok && gameStarts.load() < 2 * totalGames; ++game) {
+      Packet start;
+      bool matched;
+      ok = waitForMatch(bot, start, matched);
+      if (ok && matched) {
+        ok = playGame(bot, game, start);
+      }
+    }
+  } else {
+    for (int game = 0; ok && game < options.gamesPerPair; ++game) {
+      Packet start;
+      ok = enterRoom(bot, game, start) && playGame(bot, game, start);
+    }
+  }
+
+  Packet logout;
+  logout.type = LOGOUT;
+  send(bot, logout);
+  bot.transport->close();
+  return ok;
+}
+
+void *LoadGen::botThreadWrapper(void *context) {
+  Bot *bot = (Bot *)context;
+  bot->ok = bot->gen->runBot(*bot);
+  bot->done = true;
+  return nullptr;
+}
+
+bool LoadGen::run() {
+  int pairCount = options.bots / 2;
+  totalGames = pairCount * options.gamesPerPair;
+  std::string runId = std::to_string(getpid());
+  Xoshiro256 seeds(options.seed);
+
+  for (int i = 0; i < pairCount; ++i) {
+    pairs.emplace_back(new Pair());
+    pairs.back()->roomPrefix = "lg" + runId + "_" + std::to_string(i) + "_";
+  }
+  for (int i = 0; i < 2 * pairCount; ++i) {
+    Bot *bot = new Bot();
+    bot->gen = this;
+    bot->id = i;
+    bot->pair = pairs[i / 2].get();
+    bot->creator = i % 2 == 0;
+    bot->login = "bot" + runId + "_" + std::to_string(i);
+    if (!bot->creator && !options.queue) {
+      // Rooms are local to a shard.
+      int shard = loginShard(bots.back()->login, options.shards);
+      std::string base = bot->login;
+      for (int n = 0; loginShard(bot->login, options.shards) != shard; ++n) {
+        bot->login = base + "_" + std::to_string(n);
+      }
+    }
+    bot->seed = seeds.next();
+    bot->strategy.reset(createShotStrategy(options.policy));
+    bot->transport.reset(createClientTransport(options.transport));
+    if (!bot->transport) {
+      std::cerr << "Unknown transport '" << options.transport << "'"
+                << std::endl;
+      delete bot;
+      return false;
+    }
+    bots.emplace_back(bot);
+  }
+
+  uint64_t start = nowNs();
+  deadlineNs = start + (uint64_t)options.timeoutSec * 1000000000ull;
+  for (auto &bot : bots) {
+    if (pthread_create(&bot->thread, nullptr, botThreadWrapper, bot.get()) !=
+        0) {
+      std::cerr << "Unable to start bot thread" << std::endl;
+      return false;
+    }
+  }
+
+  bool ok = true;
+  for (auto &bot : bots) {
+    pthread_join(bot->thread, nullptr);
+    ok = ok && bot->ok;
+  }
+  elapsedSec = (nowNs() - start) / 1e9;
+  timedOut = nowNs() > deadlineNs;
+  return ok && !timedOut;
+}
+
+static void appendPercentiles(std::ostringstream &out, const char *name,
+                              std::vector<uint64_t> &values) {
+  std::sort(values.begin(), values.end());
+  auto at = [&](double q) {
+    if (values.empty()) {
+      return 0.0;
+    }
+    size_t rank = (size_t)(q * values.size() + 0.999999);
+    return values[std::min(values.size(), std::max<size_t>(rank, 1)) - 1] /
+           1000.0;
+  };
+  out << "    \"" << name << "\": {\"count\": " << values.size()
+      << ", \"p50\": " << at(0.50) << ", \"p99\": " << at(0.99)
+      << ", \"p999\": " << at(0.999)
+      << ", \"max\": " << (values.empty() ? 0.0 : values.back() / 1000.0)
+      << "}";
+}
+
+std::string LoadGen::report() const {
+  uint64_t moves = 0;
+  int games = 0;
+  int errors = 0;
+  int failedBots = 0;
+  std::vector<uint64_t> merged[LAT_KINDS];
+  std::vector<uint64_t> all;
+
+  for (const auto &bot : bots) {
+    moves += bot->moves;
+    games += bot->gamesFinished;
+    errors += bot->errors;
+    failedBots += bot->ok ? 0 : 1;
+    for (int k = 0; k < LAT_KINDS; ++k) {
+      merged[k].insert(merged[k].end(), bot->latencies[k].begin(),
+                       bot->latencies[k].end());
+      all.insert(all.end(), bot->latencies[k].begin(),
+                 bot->latencies[k].end());
+    }
+  }
+
+  std::ostringstream out;
+  out << "{\n";
+  out << "  \"transport\": \"" << options.transport << "\",\n";
+  out << "  \"policy\": \"" << options.policy << "\",\n";
+  out << "  \"mode\": \"" << (options.queue ? "queue" : "rooms") << "\",\n";
+  out << "  \"shards\": " << options.shards << ",\n";
+  out << "  \"bots\": " << bots.size() << ",\n";
+  out << "  \"games\": " << games / 2 << ",\n";
+  out << "  \"moves\": " << moves << ",\n";
+  out << "  \"elapsed_s\": " << elapsedSec << ",\n";
+  out << "  \"moves_per_s\": " << (elapsedSec > 0 ? moves / elapsedSec : 0)
+      << ",\n";
+  out << "  \"errors\": " << errors << ",\n";
+  out << "  \"failed_bots\": " << failedBots << ",\n";
+  out << "  \"timed_out\": " << (timedOut ? "true" : "false") << ",\n";
+  out << "  \"latency_us\": {\n";
+  for (int k = 0; k < LAT_KINDS; ++k) {
+    appendPercentiles(out, LATENCY_NAMES[k], merged[k]);
+    out << ",\n";
+  }
+  appendPercentiles(out, "all", all);
+  out << "\n  }\n}\n";
+  return out.str();
+}
@@ -0,0 +1,58 @@
+#include "LoadGen.h"
+
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+static void usage() {
+  std::cerr << "Usage: loadgen [--bots=N] [--games=N] [--transport=fifo|shm]"
+            << " [--policy=random|hunt|density] [--seed=N] [--timeout=SEC]"
+            << " [--mode=rooms|queue] [--shards=K]"
+            << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+  LoadGenOptions options;
+  for (int i = 1; i < argc; ++i) {
+    if (strncmp(argv[i], "--bots=", 7) == 0) {
+      options.bots = atoi(argv[i] + 7);
+    } else if (strncmp(argv[i], "--games=", 8) == 0) {
+      options.gamesPerPair = atoi(argv[i] + 8);
+    } else if (strncmp(argv[i], "--transport=", 12) == 0) {
+      options.transport = argv[i] + 12;
+    } else if (strncmp(argv[i], "--policy=", 9) == 0) {
+      options.policy = argv[i] + 9;
+    } else if (strncmp(argv[i], "--seed=", 7) == 0) {
+      options.seed = strtoull(argv[i] + 7, nullptr, 10);
+    } else if (strcmp(argv[i], "--mode=rooms") == 0) {
+      options.queue = false;
+    } else if (strcmp(argv[i], "--mode=queue") == 0) {
+      options.queue = true;
+    } else if (strncmp(argv[i], "--shards=", 9) == 0) {
+      options.shards = atoi(argv[i] + 9);
+    } else if (strncmp(argv[i], "--timeout=", 10) == 0) {
+      options.timeoutSec = atoi(argv[i] + 10);
+    } else {
+      usage();
+      return 1;
+    }
+  }
+
+  if (options.bots < 2 || options.gamesPerPair < 1 || options.shards < 1 ||
+      options.shards > MAX_SHARDS ||
+      (options.policy != "random" && options.policy != "hunt" &&
+       options.policy != "density")) {
+    usage();
+    return 1;
+  }
+  if (options.bots % 2 != 0) {
+    std::cerr << "Bots play in pairs, using " << options.bots - 1 << std::endl;
+  }
+
+  std::signal(SIGPIPE, SIG_IGN);
+  LoadGen loadgen(options);
+  bool ok = loadgen.run();
+  std::cout << loadgen.report();
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,47 @@
+#include "GamePool.h"
+
+GamePool::GamePool(int capacity) : sessions(capacity > 0 ? capacity : 1) {
+  pthread_mutex_init(&mutex, nullptr);
+  // Handed out lowest first, so the games in use stay spread over the
+  // shard mutexes.
+  freeHandles.reserve(sessions.size());
+  for (int handle = (int)sessions.size() - 1; handle >= 0; --handle) {
+    freeHandles.push_back(handle);
+  }
+}
+
+GamePool::~GamePool() { pthread_mutex_destroy(&mutex); }
+
+int GamePool::alloc() {
+  pthread_mutex_lock(&mutex);
+  int handle = NO_GAME;
+  if (!freeHandles.empty()) {
+    handle = freeHandles.back();
+    freeHandles.pop_back();
+  }
+  pthread_mutex_unlock(&mutex);
+
+  if (handle != NO_GAME) {
+    sessions[handle].handle = handle;
+  }
+  return handle;
+}
+
+void GamePool::release(int handle) {
+  GameSession *session = get(handle);
+  if (!session || session->handle == NO_GAME) {
+    return;
+  }
+  *session = GameSession();
+
+  pthread_mutex_lock(&mutex);
+  freeHandles.push_back(handle);
+  pthread_mutex_unlock(&mutex);
+}
+
+int GamePool::size() {
+  pthread_mutex_lock(&mutex);
+  int used = (int)(sessions.size() - freeHandles.size());
+  pthread_mutex_unlock(&mutex);
+  return used;
+}
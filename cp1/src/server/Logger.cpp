@@ -0,0 +1,254 @@
+#include "Logger.h"
+#include "protocol.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <unistd.h>
+
+thread_local Logger *Logger::cachedOwner = nullptr;
+thread_local Logger::Ring *Logger::cached = nullptr;
+
+static const char *REJECTION_REASONS[] = {"shooter not found", "not in a game",
+                                          "no opponent", "victim not found"};
+
+static uint64_t nowNs() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void copyName(char *dst, std::string_view src) {
+  size_t n = std::min(src.size(), LogRecord::NAME_SIZE - 1);
+  memcpy(dst, src.data(), n);
+  dst[n] = '\0';
+}
+
+Logger::Logger()
+    : minLevel(LOG_INFO), sampleEvery(1), running(false) {
+  rings_mutex = PTHREAD_MUTEX_INITIALIZER;
+  wake_mutex = PTHREAD_MUTEX_INITIALIZER;
+  wake_cond = PTHREAD_COND_INITIALIZER;
+}
+
+Logger::~Logger() {
+  stop();
+  for (Ring *ring : rings) {
+    delete ring;
+  }
+  pthread_mutex_destroy(&rings_mutex);
+  pthread_mutex_destroy(&wake_mutex);
+  pthread_cond_destroy(&wake_cond);
+}
+
+Logger::Ring *Logger::registerThread() {
+  Ring *ring = new Ring();
+  pthread_mutex_lock(&rings_mutex);
+  rings.push_back(ring);
+  pthread_mutex_unlock(&rings_mutex);
+  return ring;
+}
+
+void Logger::log(LogLevel level, LogEvent event, std::string_view player,
+                 std::string_view other, std::string_view game, int x, int y,
+                 uint64_t value, bool sampled) {
+  if (level < minLevel) {
+    return;
+  }
+  Ring *ring = threadRing();
+  if (sampled && sampleEvery > 1 && ring->sampleCounter++ % sampleEvery != 0) {
+    return;
+  }
+
+  uint32_t tail = ring->tail.load(std::memory_order_relaxed);
+  if (tail - ring->head.load(std::memory_order_acquire) == Ring::CAPACITY) {
+    ring->dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+
+  LogRecord &rec = ring->records[tail % Ring::CAPACITY];
+  rec.timeNs = nowNs();
+  rec.level = (uint8_t)level;
+  rec.event = (uint8_t)event;
+  rec.x = x;
+  rec.y = y;
+  rec.value = value;
+  copyName(rec.player, player);
+  copyName(rec.other, other);
+  copyName(rec.game, game);
+  ring->tail.store(tail + 1, std::memory_order_release);
+}
+
+void Logger::start() {
+  if (running) {
+    return;
+  }
+  running = true;
+  if (pthread_create(&thread, nullptr, threadWrapper, this) != 0) {
+    std::cerr << "[Error] Unable to start the logger, logging is disabled"
+              << std::endl;
+    running = false;
+    minLevel = (LogLevel)(LOG_ERROR + 1);
+  }
+}
+
+void Logger::stop() {
+  if (!running) {
+    return;
+  }
+  pthread_mutex_lock(&wake_mutex);
+  running = false;
+  pthread_cond_signal(&wake_cond);
+  pthread_mutex_unlock(&wake_mutex);
+  pthread_join(thread, nullptr);
+}
+
+void *Logger::threadWrapper(void *context) {
+  ((Logger *)context)->writerLoop();
+  return nullptr;
+}
+
+void Logger::writerLoop() {
+  std::vector<LogRecord> batch;
+  std::string out;
+
+  pthread_mutex_lock(&wake_mutex);
+  while (running) {
+    timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += FLUSH_INTERVAL_MS * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+      deadline.tv_sec += 1;
+      deadline.tv_nsec -= 1000000000L;
+    }
+    pthread_cond_timedwait(&wake_cond, &wake_mutex, &deadline);
+
+    pthread_mutex_unlock(&wake_mutex);
+    drain(batch, out);
+    pthread_mutex_lock(&wake_mutex);
+  }
+  pthread_mutex_unlock(&wake_mutex);
+
+  // Producers are stopped by now; pick up whatever they left behind.
+  drain(batch, out);
+}
+
+static void formatRecord(const LogRecord &rec, std::string &out) {
+  char line[256];
+  switch (rec.event) {
+  case EV_LOGIN:
+    snprintf(line, sizeof(line), "[Login] New player: %s\n", rec.player);
+    break;
+  case EV_LOGIN_REJECTED:
+    snprintf(line, sizeof(line), "[Login] Reject: %s is already online.\n",
+             rec.player);
+    break;
+  case EV_LOGOUT:
+    snprintf(line, sizeof(line),
+             "[Logout] Player %s removed from server's list.\n", rec.player);
+    break;
+  case EV_GAME_CREATED:
+    snprintf(line, sizeof(line), "[Game Created] %s by %s\n", rec.game,
+             rec.player);
+    break;
+  case EV_GAME_JOINED:
+    snprintf(line, sizeof(line), "[Game Joined] %s joined %s\n", rec.player,
+             rec.game);
+    break;
+  case EV_GAME_CANCELLED:
+    snprintf(line, sizeof(line), "[Game Cancelled] %s cancelled %s\n",
+             rec.player, rec.game);
+    break;
+  case EV_GAME_START:
+    snprintf(line, sizeof(line), "[Game Start] %s: %s vs %s (seed %llu)\n",
+             rec.game, rec.player, rec.other, (unsigned long long)rec.value);
+    break;
+  case EV_SHOT:
+    snprintf(line, sizeof(line), "[Shoot] %s at (%d, %d)\n", rec.player,
+             rec.x, rec.y);
+    break;
+  case EV_GAME_OVER:
+    snprintf(line, sizeof(line), "[Game Over] Winner:%s\n", rec.player);
+    break;
+  case EV_SHOT_REJECTED:
+    snprintf(line, sizeof(line), "[Warning] Shot from %s ignored: %s\n",
+             rec.player,
+             rec.x >= 0 && rec.x <= REJECT_NO_VICTIM ? REJECTION_REASONS[rec.x]
+                                                     : "unknown reason");
+    break;
+  case EV_QUEUED:
+    snprintf(line, sizeof(line),
+             "[Queue] %s is looking for a game (rating %d)\n", rec.player,
+             rec.x);
+    break;
+  case EV_TURN_TIMEOUT:
+    snprintf(line, sizeof(line),
+             "[Timeout] %s ran out of time, %s wins %s\n", rec.player,
+             rec.other, rec.game);
+    break;
+  case EV_IDLE_TIMEOUT:
+    snprintf(line, sizeof(line),
+             "[Timeout] %s silent for %llu s, disconnecting\n", rec.player,
+             (unsigned long long)rec.value);
+    break;
+  case EV_REDIRECTED:
+    snprintf(line, sizeof(line), "[Shard] %s sent to shard %d%s\n",
+             rec.player, rec.x,
+             rec.y == REDIRECT_MATCH ? " for a cross-shard game" : "");
+    break;
+  default:
+    return;
+  }
+  out += line;
+}
+
+void Logger::drain(std::vector<LogRecord> &batch, std::string &out) {
+  batch.clear();
+  out.clear();
+  uint64_t dropped = 0;
+
+  pthread_mutex_lock(&rings_mutex);
+  for (Ring *ring : rings) {
+    uint32_t head = ring->head.load(std::memory_order_relaxed);
+    uint32_t tail = ring->tail.load(std::memory_order_acquire);
+    for (; head != tail; ++head) {
+      batch.push_back(ring->records[head % Ring::CAPACITY]);
+    }
+    ring->head.store(head, std::memory_order_release);
+    dropped += ring->dropped.exchange(0, std::memory_order_relaxed);
+  }
+  pthread_mutex_unlock(&rings_mutex);
+
+  if (batch.empty() && dropped == 0) {
+    return;
+  }
+
+  // Each ring is in order already; merge them so lines from different
+  // threads come out in the order they were logged.
+  std::stable_sort(batch.begin(), batch.end(),
+                   [](const LogRecord &a, const LogRecord &b) {
+                     return a.timeNs < b.timeNs;
+                   });
+  for (const LogRecord &rec : batch) {
+    formatRecord(rec, out);
+  }
+  if (dropped > 0) {
+    out += "[Warning] " + std::to_string(dropped) +
+           " log records dropped, the logger fell behind\n";
+  }
+
+  size_t written = 0;
+  while (written < out.size()) {
+    ssize_t n = write(STDOUT_FILENO, out.data() + written, out.size() - written);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    written += n;
+  }
+}
@@ -0,0 +1,84 @@
+#include "Matchmaker.h"
+
+#include <algorithm>
+
+Matchmaker::Matchmaker() : top(nullptr) {}
+
+Matchmaker::~Matchmaker() {
+  Node *node = top.exchange(nullptr);
+  while (node) {
+    Node *next = node->next;
+    delete node;
+    node = next;
+  }
+}
+
+void Matchmaker::push(const QueueEntry &entry) {
+  Node *node = new Node{entry, top.load(std::memory_order_relaxed)};
+  while (!top.compare_exchange_weak(node->next, node,
+                                    std::memory_order_release,
+                                    std::memory_order_relaxed)) {
+  }
+}
+
+void Matchmaker::takeAll(std::vector<QueueEntry> &waiting) {
+  // Taking the whole stack at once sidesteps the ABA problem of popping
+  // single nodes.
+  Node *node = top.exchange(nullptr, std::memory_order_acquire);
+  size_t first = waiting.size();
+  while (node) {
+    waiting.push_back(node->entry);
+    Node *next = node->next;
+    delete node;
+    node = next;
+  }
+  // The stack yields the newest first.
+  std::reverse(waiting.begin() + first, waiting.end());
+}
+
+void Matchmaker::pair(std::vector<QueueEntry> &waiting, bool rated,
+                      uint64_t nowNs,
+                      std::vector<std::pair<QueueEntry, QueueEntry>> &pairs) {
+  if (!rated) {
+    size_t i = 0;
+    for (; i + 1 < waiting.size(); i += 2) {
+      pairs.emplace_back(waiting[i], waiting[i + 1]);
+    }
+    waiting.erase(waiting.begin(), waiting.begin() + i);
+    return;
+  }
+
+  std::stable_sort(waiting.begin(), waiting.end(),
+                   [](const QueueEntry &a, const QueueEntry &b) {
+                     return a.rating < b.rating;
+                   });
+
+  std::vector<QueueEntry> left;
+  size_t i = 0;
+  while (i < waiting.size()) {
+    if (i + 1 == waiting.size()) {
+      left.push_back(waiting[i]);
+      break;
+    }
+    const QueueEntry &a = waiting[i];
+    const QueueEntry &b = waiting[i + 1];
+    // The longer wait of the two sets the window, so a player who has waited
+    // long enough is not held back by a newcomer.
+    uint64_t waitedNs = nowNs - std::min(a.enqueuedNs, b.enqueuedNs);
+    uint64_t window =
+        BASE_RATING_WINDOW + RATING_WINDOW_PER_SEC * waitedNs / 1000000000ull;
+    if ((uint64_t)(b.rating - a.rating) <= window) {
+      pairs.emplace_back(a, b);
+      i += 2;
+    } else {
+      left.push_back(a);
+      i += 1;
+    }
+  }
+
+  std::sort(left.begin(), left.end(),
+            [](const QueueEntry &a, const QueueEntry &b) {
+              return a.enqueuedNs < b.enqueuedNs;
+            });
+  waiting.swap(left);
+}
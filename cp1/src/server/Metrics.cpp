@@ -0,0 +1,240 @@
+#include "Metrics.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <sstream>
+
+thread_local Metrics *Metrics::cachedOwner = nullptr;
+thread_local Metrics::ThreadMetrics *Metrics::cached = nullptr;
+
+static const char *MSG_TYPE_NAMES[] = {
+    "LOGIN",          "CREATE_GAME",   "JOIN_GAME",      "LEAVE_GAME",
+    "SHOOT",          "LOGOUT",        "GET_STATS",      "GET_GAME_LIST",
+    "S_MSG",          "S_GAME_LIST",   "S_GAME_CREATED", "S_GAME_START",
+    "S_SHOT_RESULT",  "S_GAME_OVER",   "S_BOARD",        "S_STATS",
+    "GET_BOARD",      "S_BOARD_DELTA", "S_ROOM_ADDED",   "S_ROOM_REMOVED",
+    "S_LOGIN_ACK",    "ADMIN_METRICS", "S_METRICS",      "QUEUE",
+    "HEARTBEAT",      "S_REDIRECT",    "SPECTATE",       "S_WATCHING",
+    "TIMER_EXPIRED"};
+
+static const char *COUNTER_NAMES[] = {
+    "packets_in",    "packets_rejected", "frames_out",
+    "send_failures", "games_started",    "games_finished",
+    "turn_timeouts", "idle_timeouts",    "inbound_batches",
+    "list_locks",    "spectators_dropped"};
+
+static const char *GAUGE_NAMES[] = {
+    "players_online", "active_games", "open_rooms", "lobby_size",
+    "inbound_backlog", "match_queue", "armed_timers", "spectators"};
+
+static_assert(sizeof(MSG_TYPE_NAMES) / sizeof(*MSG_TYPE_NAMES) == MSG_TYPE_COUNT,
+              "every MsgType needs a name");
+static_assert(sizeof(COUNTER_NAMES) / sizeof(*COUNTER_NAMES) == CNT_COUNT,
+              "every counter needs a name");
+static_assert(sizeof(GAUGE_NAMES) / sizeof(*GAUGE_NAMES) == GAUGE_COUNT,
+              "every gauge needs a name");
+
+Histogram::Histogram() : total(0), max(0) {
+  for (auto &bucket : buckets) {
+    bucket.store(0, std::memory_order_relaxed);
+  }
+}
+
+uint64_t Histogram::bucketLimit(int bucket) {
+  if (bucket < SUB_COUNT) {
+    return bucket;
+  }
+  int shift = bucket / SUB_COUNT - 1;
+  uint64_t sub = bucket % SUB_COUNT;
+  return ((SUB_COUNT + sub + 1) << shift) - 1;
+}
+
+void Histogram::collect(std::vector<uint64_t> &counts, uint64_t &sum,
+                        uint64_t &maxValue) const {
+  for (int i = 0; i < BUCKETS; ++i) {
+    counts[i] += buckets[i].load(std::memory_order_relaxed);
+  }
+  sum += total.load(std::memory_order_relaxed);
+  uint64_t m = max.load(std::memory_order_relaxed);
+  if (m > maxValue) {
+    maxValue = m;
+  }
+}
+
+Metrics::ThreadMetrics::ThreadMetrics() {
+  for (auto &counter : counters) {
+    counter.store(0, std::memory_order_relaxed);
+  }
+}
+
+Metrics::Metrics()
+    : startNs(nowNs()), dumpIntervalSec(0), dumperRunning(false) {
+  threads_mutex = PTHREAD_MUTEX_INITIALIZER;
+  dump_mutex = PTHREAD_MUTEX_INITIALIZER;
+  dump_cond = PTHREAD_COND_INITIALIZER;
+  for (auto &gauge : gauges) {
+    gauge.store(0, std::memory_order_relaxed);
+  }
+}
+
+Metrics::~Metrics() {
+  stopDumper();
+  // Blocks of threads that have exited stay registered until here, their
+  // counts are still part of the totals.
+  for (ThreadMetrics *t : threads) {
+    delete t;
+  }
+  pthread_mutex_destroy(&threads_mutex);
+  pthread_mutex_destroy(&dump_mutex);
+  pthread_cond_destroy(&dump_cond);
+}
+
+uint64_t Metrics::nowNs() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+Metrics::ThreadMetrics *Metrics::registerThread() {
+  ThreadMetrics *t = new ThreadMetrics();
+  pthread_mutex_lock(&threads_mutex);
+  threads.push_back(t);
+  pthread_mutex_unlock(&threads_mutex);
+  return t;
+}
+
+static void appendHistogram(std::ostringstream &out, const char *name,
+                            const std::vector<uint64_t> &counts, uint64_t sum,
+                            uint64_t maxValue) {
+  uint64_t n = 0;
+  for (uint64_t c : counts) {
+    n += c;
+  }
+  if (n == 0) {
+    return;
+  }
+
+  const double quantiles[] = {0.5, 0.99, 0.999};
+  double values[3];
+  int q = 0;
+  uint64_t seen = 0;
+  for (int i = 0; i < Histogram::BUCKETS && q < 3; ++i) {
+    seen += counts[i];
+    while (q < 3 && seen >= quantiles[q] * n) {
+      values[q++] = Histogram::bucketLimit(i) / 1000.0;
+    }
+  }
+
+  char line[256];
+  snprintf(line, sizeof(line),
+           "histogram %s count=%llu mean_us=%.2f p50_us=%.2f p99_us=%.2f "
+           "p999_us=%.2f max_us=%.2f\n",
+           name, (unsigned long long)n, sum / 1000.0 / n, values[0],
+           values[1], values[2], maxValue / 1000.0);
+  out << line;
+}
+
+std::string Metrics::snapshot() {
+  uint64_t counters[CNT_COUNT] = {};
+  std::vector<std::vector<uint64_t>> handlers(
+      MSG_TYPE_COUNT, std::vector<uint64_t>(Histogram::BUCKETS));
+  uint64_t handlerSums[MSG_TYPE_COUNT] = {};
+  uint64_t handlerMax[MSG_TYPE_COUNT] = {};
+  std::vector<uint64_t> queue(Histogram::BUCKETS);
+  uint64_t queueSum = 0;
+  uint64_t queueMax = 0;
+
+  pthread_mutex_lock(&threads_mutex);
+  for (ThreadMetrics *t : threads) {
+    for (int i = 0; i < CNT_COUNT; ++i) {
+      counters[i] += t->counters[i].load(std::memory_order_relaxed);
+    }
+    for (int type = 0; type < MSG_TYPE_COUNT; ++type) {
+      t->handlers[type].collect(handlers[type], handlerSums[type],
+                                handlerMax[type]);
+    }
+    t->queueWait.collect(queue, queueSum, queueMax);
+  }
+  pthread_mutex_unlock(&threads_mutex);
+
+  std::ostringstream out;
+  out << "uptime_s " << (nowNs() - startNs) / 1000000000ull << "\n";
+  for (int i = 0; i < CNT_COUNT; ++i) {
+    out << "counter " << COUNTER_NAMES[i] << " " << counters[i] << "\n";
+  }
+  for (int i = 0; i < GAUGE_COUNT; ++i) {
+    out << "gauge " << GAUGE_NAMES[i] << " "
+        << gauges[i].load(std::memory_order_relaxed) << "\n";
+  }
+  appendHistogram(out, "queue_wait", queue, queueSum, queueMax);
+  for (int type = 0; type < MSG_TYPE_COUNT; ++type) {
+    std::string name = std::string("handler.") + MSG_TYPE_NAMES[type];
+    appendHistogram(out, name.c_str(), handlers[type], handlerSums[type],
+                    handlerMax[type]);
+  }
+  return out.str();
+}
+
+void Metrics::startDumper(const std::string &path, int intervalSec) {
+  if (dumperRunning || path.empty() || intervalSec <= 0) {
+    return;
+  }
+  dumpPath = path;
+  dumpIntervalSec = intervalSec;
+  dumperRunning = true;
+  if (pthread_create(&dumper, nullptr, dumperThreadWrapper, this) != 0) {
+    std::cerr << "[Error] Unable to start the metrics dumper" << std::endl;
+    dumperRunning = false;
+  }
+}
+
+void Metrics::stopDumper() {
+  if (!dumperRunning) {
+    return;
+  }
+  pthread_mutex_lock(&dump_mutex);
+  dumperRunning = false;
+  pthread_cond_signal(&dump_cond);
+  pthread_mutex_unlock(&dump_mutex);
+  pthread_join(dumper, nullptr);
+  writeDump();
+}
+
+void *Metrics::dumperThreadWrapper(void *context) {
+  ((Metrics *)context)->dumpLoop();
+  return nullptr;
+}
+
+void Metrics::dumpLoop() {
+  pthread_mutex_lock(&dump_mutex);
+  while (dumperRunning) {
+    timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += dumpIntervalSec;
+    pthread_cond_timedwait(&dump_cond, &dump_mutex, &deadline);
+    if (dumperRunning) {
+      pthread_mutex_unlock(&dump_mutex);
+      writeDump();
+      pthread_mutex_lock(&dump_mutex);
+    }
+  }
+  pthread_mutex_unlock(&dump_mutex);
+}
+
+void Metrics::writeDump() {
+  // Written next to the target and renamed, so readers never see half a dump.
+  std::string tmpPath = dumpPath + ".tmp";
+  FILE *file = fopen(tmpPath.c_str(), "w");
+  if (!file) {
+    std::cerr << "[Error] Unable to write " << tmpPath << ": "
+              << strerror(errno) << std::endl;
+    return;
+  }
+  std::string text = snapshot();
+  fwrite(text.data(), 1, text.size(), file);
+  fclose(file);
+  rename(tmpPath.c_str(), dumpPath.c_str());
+}
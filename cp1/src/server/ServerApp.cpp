@@ -1,137 +1,302 @@
 #include "ServerApp.h"
 
 #include <algorithm>
+#include <csignal>
 #include <cstring>
+#include <functional>
 #include <iostream>
 #include <sstream>
+#include <unistd.h>
 
-ServerApp::ServerApp() : serverPipe(SERVER_PIPE), isRunning(true) {
-  list_mutex = PTHREAD_MUTEX_INITIALIZER;
+// Set by SIGINT/SIGTERM so run() can shut down cleanly and persist stats.
+static volatile sig_atomic_t stopRequested = 0;
+
+static void handleStopSignal(int) { stopRequested = 1; }
+
+ServerApp::ServerApp(ServerTransport &transport, const ServerOptions &options)
+    : games(options.maxGames), gameListDirty(true), stats(options.statsPath),
+      transport(transport), isRunning(true),
+      spectators(transport, metrics, options.maxGames),
+      nextSessionGeneration(1), options(options), seedSource(options.seed),
+      matcherRunning(false), nextQueueTicket(1), nextMatchId(1),
+      timers(nowMs(), TIMER_TICK_MS) {
+  pthread_rwlock_init(&list_lock, nullptr);
+  pthread_mutex_init(&timer_mutex, nullptr);
+  pthread_mutex_init(&matcher_mutex, nullptr);
+  pthread_cond_init(&matcher_cond, nullptr);
+  for (int i = 0; i < NUM_GAME_SHARDS; ++i) {
+    pthread_mutex_init(&shard_mutexes[i], nullptr);
+  }
+  logger.setLevel(options.logLevel);
+  logger.setSampling(options.logSample);
 }
 
-ServerApp::~ServerApp() { pthread_mutex_destroy(&list_mutex); }
+ServerApp::~ServerApp() {
+  pthread_rwlock_destroy(&list_lock);
+  pthread_mutex_destroy(&matcher_mutex);
+  pthread_cond_destroy(&matcher_cond);
+  pthread_mutex_destroy(&timer_mutex);
+  for (int i = 0; i < NUM_GAME_SHARDS; ++i) {
+    pthread_mutex_destroy(&shard_mutexes[i]);
+  }
+}
 
 void ServerApp::sendToClient(const std::string &login, Packet &pkt) {
-  std::string pipePath = CLIENT_PIPE_PREFIX + login;
-  NamedPipe pipe(pipePath);
-  if (pipe.openPipe(O_WRONLY)) {
-    pipe.send(&pkt, sizeof(Packet));
-    pipe.closePipe();
+  char frame[MAX_FRAME_SIZE];
+  size_t frameSize = encodeFrame(pkt, frame);
+  sendFrame(login, frame, frameSize);
+}
+
+void ServerApp::sendFrame(const std::string &login, const char *frame,
+                          size_t frameSize) {
+  if (transport.send(login, frame, frameSize)) {
+    metrics.count(CNT_FRAMES_OUT);
   } else {
-    std::cerr << "[Error] Failed to send message to player " << login
-              << " (pipe is not available)\n";
+    metrics.count(CNT_SEND_FAILURES);
   }
 }
 
-void ServerApp::sendBoard(Player *pTarget, GameBoard &boardOwner,
-                          bool showShips, const char *title) {
+static_assert(VIEWPORT_SIZE * VIEWPORT_SIZE <= sizeof(Packet::payload),
+              "a board window must fit into one packet");
+
+void ServerApp::sendBoardSnapshot(const std::string &login,
+                                  const AnyBoard &board, bool showShips,
+                                  BoardId boardId, int left, int top) {
+  // The window is kept on the board, so a smaller board is always whole.
+  int side = viewportSide(board.size());
+  int limit = board.size() - side;
   Packet pkt;
   pkt.type = S_BOARD;
-  strcpy(pkt.sender, "SERVER");
+  pkt.x = boardId;
+  pkt.y = board.size();
+  pkt.left = left < 0 ? 0 : left > limit ? limit : left;
+  pkt.top = top < 0 ? 0 : top > limit ? limit : top;
+  board.getViewport(pkt.left, pkt.top, side, pkt.payload, showShips);
+  sendToClient(login, pkt);
+}
 
-  char boardStr[400];
-  boardOwner.getBoardString(boardStr, showShips);
+void ServerApp::sendCellUpdate(const std::string &login, BoardId boardId,
+                               int x, int y, const AnyBoard &board) {
+  Packet pkt;
+  pkt.type = S_BOARD_DELTA;
+  pkt.x = boardId;
+  pkt.y = 1;
+  int16_t coords[2] = {(int16_t)x, (int16_t)y};
+  memcpy(pkt.payload, coords, sizeof(coords));
+  pkt.payload[sizeof(coords)] = (char)board.getCell(x, y);
+  sendToClient(login, pkt);
+}
 
-  sprintf(pkt.payload, "%s\n%s", title, boardStr);
-  sendToClient(pTarget->login, pkt);
+void ServerApp::sendBoards(Player *player, int left, int top) {
+  GameSession *game = games.get(player->game);
+  int seat = game ? game->seatOf(player->handle) : -1;
+  if (seat < 0) {
+    return;
+  }
+  sendBoardSnapshot(player->login, game->boards[seat], true, BOARD_OWN, left,
+                    top);
+  sendBoardSnapshot(player->login, game->boards[1 - seat], false, BOARD_RADAR,
+                    left, top);
 }
 
-Player *ServerApp::findPlayer(const std::string &login) {
-  for (auto &p : players) {
-    if (p.login == login)
-      return &p;
+bool ServerApp::resolveSender(Packet &pkt) {
+  Player *player = players.get(pkt.session & SESSION_HANDLE_MASK);
+  if (!player || player->sessionId != pkt.session) {
+    return false;
   }
-  return nullptr;
+  strncpy(pkt.sender, player->login.c_str(), sizeof(pkt.sender) - 1);
+  // Only a plain store per packet; the idle timer checks it when it fires.
+  if (pkt.type != TIMER_EXPIRED) {
+    player->lastSeenMs = nowMs();
+  }
+  return true;
 }
 
-GameRoom *ServerApp::findGameRoom(const std::string &gameName) {
-  for (auto &room : gameRooms) {
-    if (room.name == gameName)
-      return &room;
+Player *ServerApp::findPlayer(std::string_view login) {
+  auto it = playerIndex.find(login);
+  if (it == playerIndex.end()) {
+    return nullptr;
   }
-  return nullptr;
+  return players.get(it->second);
+}
+
+GameRoom *ServerApp::findGameRoom(std::string_view gameName) {
+  auto it = roomIndex.find(gameName);
+  if (it == roomIndex.end()) {
+    return nullptr;
+  }
+  return gameRooms.get(it->second);
 }
 
-PlayerStats *ServerApp::getPlayerStats(const std::string &login) {
-  auto it = playerStats.find(login);
-  if (it != playerStats.end()) {
-    return &it->second;
+void ServerApp::removeGameRoom(std::string_view gameName) {
+  auto it = roomIndex.find(gameName);
+  if (it == roomIndex.end()) {
+    return;
   }
 
-  PlayerStats newStats;
-  newStats.login = login;
-  newStats.gamesPlayed = 0;
-  newStats.wins = 0;
-  newStats.losses = 0;
-  newStats.totalShots = 0;
-  newStats.hits = 0;
-  newStats.accuracy = 0.0;
-  
-  playerStats[login] = newStats;
-  return &playerStats[login];
+  // gameName may view the room's own name, copy it before the release.
+  int handle = it->second;
+  Packet removed;
+  removed.type = S_ROOM_REMOVED;
+  strncpy(removed.gameName, gameRooms.get(handle)->name.c_str(),
+          sizeof(removed.gameName) - 1);
+
+  roomIndex.erase(it);
+  gameRooms.release(handle);
+
+  gameListDirty = true;
+  broadcastLobby(removed);
 }
 
-void ServerApp::updateStatsAfterGame(const std::string &winner, const std::string &loser) {
-  PlayerStats *winnerStats = getPlayerStats(winner);
-  PlayerStats *loserStats = getPlayerStats(loser);
-  
-  winnerStats->gamesPlayed++;
-  winnerStats->wins++;
-  
-  loserStats->gamesPlayed++;
-  loserStats->losses++;
-  
-  if (winnerStats->totalShots > 0) {
-    winnerStats->accuracy = (double)winnerStats->hits / winnerStats->totalShots * 100;
+void ServerApp::updateStatsAfterGame(const GameSession &game, int winnerSeat) {
+  int loserSeat = 1 - winnerSeat;
+  Player *winner = players.get(game.players[winnerSeat]);
+  Player *loser = players.get(game.players[loserSeat]);
+  if (winner && loser &&
+      (winner->homeShard != options.shardIndex ||
+       loser->homeShard != options.shardIndex)) {
+    recordResult(winner, true, game.shots[winnerSeat], game.hits[winnerSeat]);
+    recordResult(loser, false, game.shots[loserSeat], game.hits[loserSeat]);
+  } else if (winner && loser) {
+    stats.recordGame(winner->login, loser->login);
   }
-  if (loserStats->totalShots > 0) {
-    loserStats->accuracy = (double)loserStats->hits / loserStats->totalShots * 100;
+  metrics.count(CNT_GAMES_FINISHED);
+  metrics.addGauge(GAUGE_ACTIVE_GAMES, -1);
+}
+
+void ServerApp::broadcastLobby(Packet &pkt) {
+  char frame[MAX_FRAME_SIZE];
+  size_t frameSize = encodeFrame(pkt, frame);
+
+  for (int handle : lobbySubscribers) {
+    Player *p = players.get(handle);
+    if (p) {
+      sendFrame(p->login, frame, frameSize);
+    }
   }
 }
 
-void ServerApp::sendGameList(const std::string &login) {
+void ServerApp::rebuildGameListPages() {
+  std::vector<std::string> pages;
+  std::string page;
+  gameRooms.forEach([&](const GameRoom &room) {
+    if (room.isFull || room.isActive) {
+      return;
+    }
+    std::string line = room.name + " (created by " + room.creator;
+    if (room.mode != MODE_CLASSIC) {
+      int size = BOARD_MODE_SIZES[room.mode];
+      line += ", " + std::string(BOARD_MODE_NAMES[room.mode]) + " " +
+              std::to_string(size) + "x" + std::to_string(size);
+    }
+    line += ")\n";
+    if (!page.empty() && page.size() + line.size() > GAME_LIST_PAGE_BYTES) {
+      pages.push_back(page);
+      page.clear();
+    }
+    page += line;
+  });
+  if (!page.empty()) {
+    pages.push_back(page);
+  }
+
+  gameListPages.clear();
   Packet pkt;
   pkt.type = S_GAME_LIST;
-  strcpy(pkt.sender, "SERVER");
-  
-  std::stringstream ss;
-  ss << "Available games:\n";
-  ss << "================\n";
-  
-  int count = 0;
-  for (const auto &room : gameRooms) {
-    if (!room.isFull && !room.isActive) {
-      ss << room.name << " (created by " << room.creator << ")\n";
-      count++;
-    }
+
+  if (pages.empty()) {
+    snprintf(pkt.payload, sizeof(pkt.payload),
+             "Available games:\n================\n"
+             "No available games. Create your own with /create <game_name>\n");
+    char frame[MAX_FRAME_SIZE];
+    gameListPages.emplace_back(frame, encodeFrame(pkt, frame));
   }
-  
-  if (count == 0) {
-    ss << "No available games. Create your own with /create <game_name>\n";
-  } else {
-    ss << "\nTo join game: /join <game_name>\n";
+
+  for (size_t i = 0; i < pages.size(); ++i) {
+    std::string next = i + 1 < pages.size()
+                           ? "Next page: /list " + std::to_string(i + 2) + "\n"
+                           : "";
+    snprintf(pkt.payload, sizeof(pkt.payload),
+             "Available games (page %zu/%zu):\n================\n%s"
+             "\nTo join game: /join <game_name>\n%s",
+             i + 1, pages.size(), pages[i].c_str(), next.c_str());
+    char frame[MAX_FRAME_SIZE];
+    gameListPages.emplace_back(frame, encodeFrame(pkt, frame));
   }
-  
-  strcpy(pkt.payload, ss.str().c_str());
-  sendToClient(login, pkt);
+
+  gameListDirty = false;
+}
+
+void ServerApp::sendGameList(const std::string &login, int page) {
+  Player *player = findPlayer(login);
+  if (player && player->game == NO_GAME) {
+    lobbySubscribers.insert(player->handle);
+  }
+
+  if (gameListDirty) {
+    rebuildGameListPages();
+  }
+  if (page < 0 || page >= (int)gameListPages.size()) {
+    page = (int)gameListPages.size() - 1;
+  }
+
+  const std::string &frame = gameListPages[page];
+  sendFrame(login, frame.data(), frame.size());
 }
 
 void ServerApp::handleLogin(Packet &pkt) {
   if (findPlayer(pkt.sender)) {
-    std::cout << "[Login] Reject: " << pkt.sender << " is already online."
-              << std::endl;
+    logger.log(LOG_INFO, EV_LOGIN_REJECTED, pkt.sender);
+    return;
+  }
+
+  // Only a guest expected for a cross-shard game may log in away from home.
+  int home = loginShard(pkt.sender, options.shardCount);
+  auto guest = pendingGuests.find(pkt.sender);
+  if (home != options.shardIndex && guest == pendingGuests.end()) {
+    transport.connect(pkt.sender);
+    sendRedirect(pkt.sender, home, REDIRECT_HOME,
+                 "This login belongs to another server, reconnecting...");
+    transport.disconnectWhenFlushed(pkt.sender);
     return;
   }
   
-  players.push_back({pkt.sender, false, "", GameBoard(), false, ""});
-  std::cout << "[Login] New player: " << pkt.sender << std::endl;
+  int handle = players.alloc();
+  Player *player = players.get(handle);
+  player->handle = handle;
+  player->login = pkt.sender;
+  player->homeShard = home;
+  playerIndex[player->login] = handle;
+
+  // Generations run 1..1023, so no session id is ever 0.
+  unsigned int generation =
+      nextSessionGeneration++ % ((1u << (32 - SESSION_HANDLE_BITS)) - 1) + 1;
+  player->sessionId = (generation << SESSION_HANDLE_BITS) | (unsigned int)handle;
+
+  player->lastSeenMs = nowMs();
+  if (options.idleTimeoutSec > 0) {
+    armTimer(player->idleTimer, TIMER_IDLE, player,
+             options.idleTimeoutSec * 1000ull);
+  }
+
+  transport.connect(pkt.sender);
+
+  logger.log(LOG_INFO, EV_LOGIN, pkt.sender);
 
   Packet resp;
-  resp.type = S_MSG;
+  resp.type = S_LOGIN_ACK;
+  resp.session = player->sessionId;
   strcpy(resp.payload, "Welcome to the Sea Fight server!");
   sendToClient(pkt.sender, resp);
 
-  sendGameList(pkt.sender);
+  if (guest != pendingGuests.end()) {
+    PendingGuest pending = guest->second;
+    pendingGuests.erase(guest);
+    startGuestGame(player, pending);
+    return;
+  }
+
+  sendGameList(pkt.sender, 0);
 }
 
 void ServerApp::handleCreateGame(Packet &pkt) {
@@ -140,13 +305,21 @@ void ServerApp::handleCreateGame(Packet &pkt) {
     return;
   }
   
-  if (player->inGame) {
+  if (player->game != NO_GAME || player->room != NO_ROOM) {
     Packet err;
     err.type = S_MSG;
     strcpy(err.payload, "You are already in a game!");
     sendToClient(pkt.sender, err);
     return;
   }
+
+  if (player->queued) {
+    Packet err;
+    err.type = S_MSG;
+    strcpy(err.payload, "You are waiting for a match! Use '/leave' first.");
+    sendToClient(pkt.sender, err);
+    return;
+  }
   
   std::string gameName = pkt.gameName;
   if (gameName.empty()) {
@@ -156,6 +329,14 @@ void ServerApp::handleCreateGame(Packet &pkt) {
     sendToClient(pkt.sender, err);
     return;
   }
+
+  if (pkt.x < 0 || pkt.x >= BOARD_MODES) {
+    Packet err;
+    err.type = S_MSG;
+    strcpy(err.payload, "Unknown board mode!");
+    sendToClient(pkt.sender, err);
+    return;
+  }
   
   if (findGameRoom(gameName)) {
     Packet err;
@@ -165,29 +346,30 @@ void ServerApp::handleCreateGame(Packet &pkt) {
     return;
   }
 
-  GameRoom newRoom;
-  newRoom.name = gameName;
-  newRoom.creator = pkt.sender;
-  newRoom.player1 = pkt.sender;
-  newRoom.player2 = "";
-  newRoom.isFull = false;
-  newRoom.isActive = false;
-  
-  gameRooms.push_back(newRoom);
-  player->gameName = gameName;
+  int roomHandle = gameRooms.alloc();
+  GameRoom *newRoom = gameRooms.get(roomHandle);
+  newRoom->name = gameName;
+  newRoom->creator = pkt.sender;
+  newRoom->mode = (BoardMode)pkt.x;
+  newRoom->player1 = player->handle;
+  roomIndex[newRoom->name] = roomHandle;
+
+  player->room = roomHandle;
   
-  std::cout << "[Game Created] " << gameName << " by " << pkt.sender << std::endl;
+  logger.log(LOG_INFO, EV_GAME_CREATED, pkt.sender, {}, gameName);
   
   Packet resp;
   resp.type = S_GAME_CREATED;
+  strcpy(resp.gameName, gameName.c_str());
   sprintf(resp.payload, "Game '%s' created! Waiting for opponent...\nUse '/leave' to cancel", gameName.c_str());
   sendToClient(pkt.sender, resp);
 
-  for (const auto &p : players) {
-    if (!p.inGame) {
-      sendGameList(p.login);
-    }
-  }
+  gameListDirty = true;
+  Packet added;
+  added.type = S_ROOM_ADDED;
+  strcpy(added.gameName, gameName.c_str());
+  strcpy(added.payload, pkt.sender);
+  broadcastLobby(added);
 }
 
 void ServerApp::handleJoinGame(Packet &pkt) {
@@ -196,13 +378,21 @@ void ServerApp::handleJoinGame(Packet &pkt) {
     return;
   }
   
-  if (player->inGame) {
+  if (player->game != NO_GAME || player->room != NO_ROOM) {
     Packet err;
     err.type = S_MSG;
     strcpy(err.payload, "You are already in a game!");
     sendToClient(pkt.sender, err);
     return;
   }
+
+  if (player->queued) {
+    Packet err;
+    err.type = S_MSG;
+    strcpy(err.payload, "You are waiting for a match! Use '/leave' first.");
+    sendToClient(pkt.sender, err);
+    return;
+  }
   
   std::string gameName = pkt.gameName;
   GameRoom *room = findGameRoom(gameName);
@@ -231,20 +421,113 @@ void ServerApp::handleJoinGame(Packet &pkt) {
     return;
   }
 
-  room->player2 = pkt.sender;
+  if (games.full()) {
+    Packet err;
+    err.type = S_MSG;
+    strcpy(err.payload, "The server is full, try again later.");
+    sendToClient(pkt.sender, err);
+    return;
+  }
+
+  room->player2 = player->handle;
   room->isFull = true;
   
-  player->gameName = gameName;
-  player->inGame = true;
+  Player *creator = players.get(room->player1);
   
-  Player *creator = findPlayer(room->creator);
-  if (creator) {
-    creator->inGame = true;
-  }
-  
-  std::cout << "[Game Joined] " << pkt.sender << " joined " << gameName << std::endl;
+  logger.log(LOG_INFO, EV_GAME_JOINED, pkt.sender, {}, gameName);
   
-  startGame(*room);
+  room->isActive = true;
+  startGame(creator, player, gameName, (BoardMode)room->mode);
+  removeGameRoom(gameName);
+}
+
+void ServerApp::handleQueue(Packet &pkt) {
+  Player *player = findPlayer(pkt.sender);
+  if (!player) {
+    return;
+  }
+
+  if (player->game != NO_GAME || player->room != NO_ROOM || player->queued) {
+    Packet err;
+    err.type = S_MSG;
+    strcpy(err.payload, player->queued ? "You are already waiting for a match!"
+                                       : "You are already in a game!");
+    sendToClient(pkt.sender, err);
+    return;
+  }
+
+  // Laplace-smoothed win rate scaled to 0..1000; newcomers start at 500.
+  PlayerStats playerStats = stats.get(pkt.sender);
+  int rating = (playerStats.wins + 1) * 1000 / (playerStats.gamesPlayed + 2);
+
+  player->queued = true;
+  player->queueTicket = nextQueueTicket++;
+  lobbySubscribers.erase(player->handle);
+  matchmaker.push(QueueEntry{player->handle, player->sessionId,
+                             player->queueTicket, rating, Metrics::nowNs()});
+  metrics.addGauge(GAUGE_MATCH_QUEUE, 1);
+
+  logger.log(LOG_INFO, EV_QUEUED, pkt.sender, {}, {}, rating);
+
+  Packet resp;
+  resp.type = S_MSG;
+  strcpy(resp.payload,
+         "Looking for an opponent...\nUse '/leave' to stop waiting");
+  sendToClient(pkt.sender, resp);
+}
+
+void ServerApp::handleSpectate(Packet &pkt) {
+  Player *player = findPlayer(pkt.sender);
+  if (!player) {
+    return;
+  }
+
+  if (player->game != NO_GAME || player->room != NO_ROOM || player->queued) {
+    Packet err;
+    err.type = S_MSG;
+    strcpy(err.payload, "You cannot watch while you play! Use '/leave' first.");
+    sendToClient(pkt.sender, err);
+    return;
+  }
+
+  Player *target = findPlayer(pkt.payload);
+  GameSession *game = target ? games.get(target->game) : nullptr;
+  if (!game) {
+    Packet err;
+    err.type = S_MSG;
+    strcpy(err.payload, "This player is not in a game.");
+    sendToClient(pkt.sender, err);
+    return;
+  }
+
+  // Shots hold list_lock for reading, so none can land between these
+  // snapshots and the subscription; the published events continue from
+  // exactly this state.
+  Packet resp;
+  resp.type = S_WATCHING;
+  strncpy(resp.gameName, game->name.c_str(), sizeof(resp.gameName) - 1);
+  for (int seat = 0; seat < 2; ++seat) {
+    Player *seated = players.get(game->players[seat]);
+    strncat(resp.payload, seated ? seated->login.c_str() : "?",
+            sizeof(Packet::sender));
+    strcat(resp.payload, "\n");
+  }
+  sendToClient(pkt.sender, resp);
+  for (int seat = 0; seat < 2; ++seat) {
+    sendBoardSnapshot(pkt.sender, game->boards[seat], false, (BoardId)seat,
+                      0, 0);
+  }
+
+  spectators.subscribe(game->handle, player->login);
+  player->spectating = true;
+  lobbySubscribers.erase(player->handle);
+}
+
+void ServerApp::leaveQueue(Player *player) {
+  // The matcher drops the entry once it sees the ticket is gone.
+  player->queued = false;
+  player->queueTicket = 0;
+  metrics.addGauge(GAUGE_MATCH_QUEUE, -1);
 }
 
 void ServerApp::handleLeaveGame(Packet &pkt) {
@@ -252,8 +535,36 @@ void ServerApp::handleLeaveGame(Packet &pkt) {
   if (!player) {
     return;
   }
+
+  if (player->queued) {
+    leaveQueue(player);
+    Packet resp;
+    resp.type = S_MSG;
+    strcpy(resp.payload, "You left the matchmaking queue.");
+    sendToClient(pkt.sender, resp);
+    sendGameList(pkt.sender, 0);
+    return;
+  }
   
-  if (player->gameName.empty()) {
+  GameRoom *room = gameRooms.get(player->room);
+  if (player->game == NO_GAME && !room && player->spectating) {
+    spectators.unsubscribe(player->login);
+    player->spectating = false;
+    Packet resp;
+    resp.type = S_MSG;
+    strcpy(resp.payload, "You stopped watching.");
+    sendToClient(pkt.sender, resp);
+    sendGameList(pkt.sender, 0);
+    return;
+  }
+
+  if (player->game != NO_GAME) {
+    forfeitGame(player, "Opponent left the game.\n YOU WON!");
+  } else if (room) {
+    logger.log(LOG_INFO, EV_GAME_CANCELLED, player->login, {}, room->name);
+    player->room = NO_ROOM;
+    removeGameRoom(room->name);
+  } else {
     Packet err;
     err.type = S_MSG;
     strcpy(err.payload, "You are not in any game!");
@@ -261,62 +572,53 @@ void ServerApp::handleLeaveGame(Packet &pkt) {
     return;
   }
   
-  GameRoom *room = findGameRoom(player->gameName);
-  if (room) {
-    if (room->isFull) {
-      Player *opponent = findPlayer(player->opponent);
-      if (opponent) {
-        Packet winPkt;
-        winPkt.type = S_GAME_OVER;
-        strcpy(winPkt.payload, "Opponent left the game.\n YOU WON!");
-        sendToClient(opponent->login, winPkt);
-        
-        opponent->inGame = false;
-        opponent->gameName = "";
-        opponent->opponent = "";
-        opponent->isTurn = false;
-        
-        updateStatsAfterGame(opponent->login, player->login);
-      }
-    } else {
-      std::cout << "[Game Cancelled] " << player->login << " cancelled " << room->name << std::endl;
-      
-      auto it = std::remove_if(gameRooms.begin(), gameRooms.end(),
-                             [&](const GameRoom &r) { return r.name == room->name; });
-      gameRooms.erase(it, gameRooms.end());
-    }
-  }
-  
-  player->inGame = false;
-  player->gameName = "";
-  player->opponent = "";
-  player->isTurn = false;
-  
   Packet resp;
   resp.type = S_MSG;
   strcpy(resp.payload, "You left the game.");
   sendToClient(pkt.sender, resp);
   
-  sendGameList(pkt.sender);
+  sendGameList(pkt.sender, 0);
 }
 
-void ServerApp::startGame(GameRoom &room) {
-  Player *player1 = findPlayer(room.player1);
-  Player *player2 = findPlayer(room.player2);
-  
+void ServerApp::startGame(Player *player1, Player *player2,
+                          const std::string &name, BoardMode mode) {
   if (!player1 || !player2) {
     return;
   }
   
-  room.isActive = true;
-  
-  player1->opponent = player2->login;
-  player1->board.placeShipsRandomly();
-  player1->isTurn = false;
+  GameSession *game = games.get(games.alloc());
+  if (!game) {
+    return;
+  }
+
+  metrics.count(CNT_GAMES_STARTED);
+  metrics.addGauge(GAUGE_ACTIVE_GAMES, 1);
+
+  // Pool handles are dense, which spreads running games evenly.
+  int shard = game->handle % NUM_GAME_SHARDS;
+  game->name = name;
+  game->players[0] = player1->handle;
+  game->players[1] = player2->handle;
+  for (Player *player : {player1, player2}) {
+    player->game = game->handle;
+    player->room = NO_ROOM;
+    player->shard = shard;
+    if (player->spectating) {
+      spectators.unsubscribe(player->login);
+      player->spectating = false;
+    }
+  }
   
-  player2->opponent = player1->login;
-  player2->board.placeShipsRandomly();
-  player2->isTurn = true;
+  // Both fleets come from one per-game stream, so the logged seed replays
+  // the game exactly.
+  uint64_t seed = seedSource.next();
+  Xoshiro256 rng(seed);
+  for (AnyBoard &board : game->boards) {
+    board.reset(mode);
+    board.placeShips(rng, options.noTouching);
+  }
+  game->turn = 1;
+  armTurnTimer(game);
   
   Packet start;
   start.type = S_GAME_START;
@@ -329,39 +631,87 @@ void ServerApp::startGame(GameRoom &room) {
   strcat(start.payload, " (YOUR TURN)");
   sendToClient(player2->login, start);
   
-  sendBoard(player1, player1->board, true, "YOUR BOARD:");
-  sendBoard(player2, player2->board, true, "YOUR BOARD:");
-  
-  std::cout << "[Game Start] " << room.name << ": " << player1->login << " vs " << player2->login << std::endl;
+  sendBoards(player1);
+  sendBoards(player2);
   
-  auto it = std::remove_if(gameRooms.begin(), gameRooms.end(),
-                         [&](const GameRoom &r) { return r.name == room.name; });
-  gameRooms.erase(it, gameRooms.end());
+  logger.log(LOG_INFO, EV_GAME_START, player1->login, player2->login, name,
+             0, 0, seed);
   
-  for (const auto &p : players) {
-    if (!p.inGame) {
-      sendGameList(p.login);
+  lobbySubscribers.erase(player1->handle);
+  lobbySubscribers.erase(player2->handle);
+}
+
+void ServerApp::endGame(GameSession *game, int winnerSeat) {
+  Player *winner = players.get(game->players[winnerSeat]);
+  if (winner && spectators.watched(game->handle)) {
+    Packet over;
+    over.type = S_GAME_OVER;
+    snprintf(over.payload, sizeof(over.payload), "%s won the game.\n",
+             winner->login.c_str());
+    spectators.publish(game->handle, over);
+  }
+  spectators.close(game->handle);
+
+  for (int handle : game->players) {
+    Player *player = players.get(handle);
+    if (player) {
+      player->game = NO_GAME;
     }
   }
+  cancelTimer(game->turnTimer);
+  updateStatsAfterGame(*game, winnerSeat);
+  games.release(game->handle);
+}
+
+void ServerApp::forfeitGame(Player *player, const char *message) {
+  GameSession *game = games.get(player->game);
+  int seat = game ? game->seatOf(player->handle) : -1;
+  if (seat < 0) {
+    return;
+  }
+
+  Player *opponent = players.get(game->players[1 - seat]);
+  if (opponent) {
+    Packet winPkt;
+    winPkt.type = S_GAME_OVER;
+    strcpy(winPkt.payload, message);
+    sendToClient(opponent->login, winPkt);
+  }
+  endGame(game, 1 - seat);
 }
 
 void ServerApp::handleShoot(Packet &pkt) {
   Player *shooter = findPlayer(pkt.sender);
 
   if (!shooter) {
-    std::cout << "Shooter not found: " << pkt.sender << "\n";
+    logger.log(LOG_WARN, EV_SHOT_REJECTED, pkt.sender, {}, {},
+               REJECT_NO_SHOOTER);
     return;
   }
-  if (!shooter->inGame) {
-    std::cout << "Shooter not in game: " << pkt.sender << "\n";
+
+  // Only the list read lock is held here: both players of a game share its
+  // shard, so games on other shards keep running in parallel.
+  pthread_mutex_t *shardMutex = &shard_mutexes[shooter->shard];
+  pthread_mutex_lock(shardMutex);
+  resolveShot(shooter, pkt);
+  pthread_mutex_unlock(shardMutex);
+}
+
+void ServerApp::resolveShot(Player *shooter, Packet &pkt) {
+  GameSession *game = games.get(shooter->game);
+  int seat = game ? game->seatOf(shooter->handle) : -1;
+  if (seat < 0) {
+    logger.log(LOG_WARN, EV_SHOT_REJECTED, pkt.sender, {}, {},
+               REJECT_NOT_IN_GAME);
     return;
   }
-  if (shooter->opponent.empty()) {
-    std::cout << "Opponent string empty for " << pkt.sender << "\n";
+  if (game->players[1 - seat] == NO_PLAYER) {
+    logger.log(LOG_WARN, EV_SHOT_REJECTED, pkt.sender, {}, {},
+               REJECT_NO_OPPONENT);
     return;
   }
 
-  if (!shooter->isTurn) {
+  if (game->turn != seat) {
     Packet err;
     err.type = S_MSG;
     strcpy(err.payload, "Now is NOT your turn. Wait for opponent.");
@@ -369,18 +719,21 @@ void ServerApp::handleShoot(Packet &pkt) {
     return;
   }
 
-  Player *victim = findPlayer(shooter->opponent);
+  Player *victim = players.get(game->players[1 - seat]);
   if (!victim) {
-    std::cout << "Victim not found: " << shooter->opponent << "\n";
+    logger.log(LOG_WARN, EV_SHOT_REJECTED, pkt.sender, {}, {},
+               REJECT_NO_VICTIM);
     return;
   }
 
-  ShotResult res = victim->board.processShot(pkt.x, pkt.y);
+  AnyBoard &target = game->boards[1 - seat];
+  ShotResult res = target.processShot(pkt.x, pkt.y);
   
-  PlayerStats *shooterStats = getPlayerStats(shooter->login);
-  shooterStats->totalShots++;
-  if (res == RES_HIT || res == RES_LOSE) {
-    shooterStats->hits++;
+  bool hit = res == RES_HIT || res == RES_SUNK || res == RES_LOSE;
+  game->shots[seat]++;
+  game->hits[seat] += hit ? 1 : 0;
+  if (shooter->homeShard == options.shardIndex) {
+    stats.recordShot(shooter->login, hit);
   }
 
   if (res == RES_REPEAT) {
@@ -392,8 +745,30 @@ void ServerApp::handleShoot(Packet &pkt) {
     return;
   }
 
-  std::cout << "[Shoot] " << shooter->login << " at (" << pkt.x << ", " << pkt.y
-            << ")" << std::endl;
+  logger.log(LOG_INFO, EV_SHOT, shooter->login, {}, {}, pkt.x, pkt.y, res,
+             true);
+
+  if (spectators.watched(game->handle)) {
+    static const char *const RESULT_NAMES[] = {"MISS", "HIT", "SUNK", "",
+                                               "SUNK, fleet destroyed"};
+    Packet shot;
+    shot.type = S_SHOT_RESULT;
+    shot.x = pkt.x;
+    shot.y = pkt.y;
+    shot.shotResult = (int)res;
+    snprintf(shot.payload, sizeof(shot.payload), "%s: %s",
+             shooter->login.c_str(), RESULT_NAMES[res]);
+    spectators.publish(game->handle, shot);
+
+    Packet cell;
+    cell.type = S_BOARD_DELTA;
+    cell.x = 1 - seat;
+    cell.y = 1;
+    int16_t coords[2] = {(int16_t)pkt.x, (int16_t)pkt.y};
+    memcpy(cell.payload, coords, sizeof(coords));
+    cell.payload[sizeof(coords)] = (char)target.getCell(pkt.x, pkt.y);
+    spectators.publish(game->handle, cell);
+  }
 
   if (res == RES_LOSE) {
     Packet pktWin;
@@ -406,19 +781,9 @@ void ServerApp::handleShoot(Packet &pkt) {
     strcpy(pktLose.payload, "LOSE! Your ships destroyed\n");
     sendToClient(victim->login, pktLose);
 
-    shooter->inGame = false;
-    shooter->gameName = "";
-    shooter->opponent = "";
-    shooter->isTurn = false;
-
-    victim->inGame = false;
-    victim->gameName = "";
-    victim->opponent = "";
-    victim->isTurn = false;
-    
-    updateStatsAfterGame(shooter->login, victim->login);
+    endGame(game, seat);
 
-    std::cout << "[Game Over] Winner:" << shooter->login << "\n";
+    logger.log(LOG_INFO, EV_GAME_OVER, shooter->login);
     return;
   }
 
@@ -430,33 +795,79 @@ void ServerApp::handleShoot(Packet &pkt) {
 
   if (res == RES_HIT) {
     strcpy(respShooter.payload, "HIT! Shoot again!");
+  } else if (res == RES_SUNK) {
+    strcpy(respShooter.payload, "SUNK! Ship destroyed, shoot again!");
   } else {
     strcpy(respShooter.payload, "MISS. Change turn...");
   }
 
   sendToClient(shooter->login, respShooter);
-
-  sendBoard(shooter, victim->board, false, "Opponent's board (Radar):");
+  sendCellUpdate(shooter->login, BOARD_RADAR, pkt.x, pkt.y, target);
 
   Packet respVictim = respShooter;
   if (res == RES_HIT) {
     strcpy(respVictim.payload, "Your ship has been HIT! Opponent's turn...");
+  } else if (res == RES_SUNK) {
+    strcpy(respVictim.payload, "Your ship has been SUNK! Opponent's turn...");
   } else {
     strcpy(respVictim.payload, "Opponent MISS! Your turn!");
   }
 
   sendToClient(victim->login, respVictim);
-
-  sendBoard(victim, victim->board, true, "Your board:");
+  sendCellUpdate(victim->login, BOARD_OWN, pkt.x, pkt.y, target);
 
   if (res == RES_MISS) {
-    shooter->isTurn = false;
-    victim->isTurn = true;
+    game->turn = 1 - seat;
+  }
+  armTurnTimer(game);
+}
+
+void ServerApp::handleGetBoard(Packet &pkt) {
+  Player *player = findPlayer(pkt.sender);
+  if (!player) {
+    return;
+  }
+
+  pthread_mutex_t *shardMutex = &shard_mutexes[player->shard];
+  pthread_mutex_lock(shardMutex);
+  sendBoards(player, pkt.x, pkt.y);
+  pthread_mutex_unlock(shardMutex);
+}
+
+void ServerApp::handleAdminMetrics(Packet &pkt) {
+  if (options.adminLogin.empty() || options.adminLogin != pkt.sender) {
+    Packet err;
+    err.type = S_MSG;
+    strcpy(err.payload, "Server metrics are only available to the admin.");
+    sendToClient(pkt.sender, err);
+    return;
+  }
+
+  // Split at line boundaries so every S_METRICS payload is whole lines.
+  std::string text = metrics.snapshot();
+  size_t limit = sizeof(Packet::payload) - 1;
+  size_t pos = 0;
+  while (pos < text.size()) {
+    size_t end = std::min(text.size(), pos + limit);
+    if (end < text.size()) {
+      size_t lineEnd = text.rfind('\n', end - 1);
+      if (lineEnd != std::string::npos && lineEnd >= pos) {
+        end = lineEnd + 1;
+      }
+    }
+
+    Packet resp;
+    resp.type = S_METRICS;
+    strcpy(resp.sender, "SERVER");
+    memcpy(resp.payload, text.data() + pos, end - pos);
+    resp.payload[end - pos] = '\0';
+    sendToClient(pkt.sender, resp);
+    pos = end;
   }
 }
 
 void ServerApp::handleGetStats(Packet &pkt) {
-  PlayerStats *stats = getPlayerStats(pkt.sender);
+  PlayerStats playerStats = stats.get(pkt.sender);
   
   Packet resp;
   resp.type = S_STATS;
@@ -465,14 +876,14 @@ void ServerApp::handleGetStats(Packet &pkt) {
   std::stringstream ss;
   ss << "Statistics for " << pkt.sender << ":\n";
   ss << "================\n";
-  ss << "Games played: " << stats->gamesPlayed << "\n";
-  ss << "Wins: " << stats->wins << "\n";
-  ss << "Losses: " << stats->losses << "\n";
-  ss << "Win rate: " << (stats->gamesPlayed > 0 ? 
-                        (double)stats->wins / stats->gamesPlayed * 100 : 0) << "%\n";
-  ss << "Total shots: " << stats->totalShots << "\n";
-  ss << "Hits: " << stats->hits << "\n";
-  ss << "Accuracy: " << stats->accuracy << "%\n";
+  ss << "Games played: " << playerStats.gamesPlayed << "\n";
+  ss << "Wins: " << playerStats.wins << "\n";
+  ss << "Losses: " << playerStats.losses << "\n";
+  ss << "Win rate: " << (playerStats.gamesPlayed > 0 ? 
+                        (double)playerStats.wins / playerStats.gamesPlayed * 100 : 0) << "%\n";
+  ss << "Total shots: " << playerStats.totalShots << "\n";
+  ss << "Hits: " << playerStats.hits << "\n";
+  ss << "Accuracy: " << playerStats.accuracy << "%\n";
   
   strcpy(resp.payload, ss.str().c_str());
   sendToClient(pkt.sender, resp);
@@ -480,84 +891,696 @@ void ServerApp::handleGetStats(Packet &pkt) {
 
 void ServerApp::handleLogout(Packet &pkt) {
   Player *quittingPlayer = findPlayer(pkt.sender);
+  if (!quittingPlayer) {
+    return;
+  }
+
+  forfeitGame(quittingPlayer, "Opponent left the game.\n YOU WON!");
+
+  if (quittingPlayer->queued) {
+    leaveQueue(quittingPlayer);
+  }
+
+  cancelTimer(quittingPlayer->idleTimer);
+
+  if (quittingPlayer->spectating) {
+    spectators.unsubscribe(quittingPlayer->login);
+  }
+
+  // A room still waiting for an opponent would otherwise keep a handle that
+  // the slab hands out to the next player who logs in.
+  GameRoom *room = gameRooms.get(quittingPlayer->room);
+  if (room) {
+    removeGameRoom(room->name);
+  }
+
+  lobbySubscribers.erase(quittingPlayer->handle);
+  playerIndex.erase(quittingPlayer->login);
+  players.release(quittingPlayer->handle);
+
+  // A redirect sent just before, as for a match on another shard, must not
+  // be dropped with the queue.
+  transport.disconnectWhenFlushed(pkt.sender);
+
+  logger.log(LOG_INFO, EV_LOGOUT, pkt.sender);
+}
+
+uint64_t ServerApp::nowMs() { return Metrics::nowNs() / 1000000; }
+
+void ServerApp::armTimer(uint64_t &slot, TimerKind kind, Player *player,
+                         uint64_t delayMs) {
+  pthread_mutex_lock(&timer_mutex);
+  timers.cancel(slot);
+  slot = timers.schedule(nowMs(), delayMs, kind, player->sessionId);
+  pthread_mutex_unlock(&timer_mutex);
+}
+
+void ServerApp::cancelTimer(uint64_t &slot) {
+  if (slot == 0) {
+    return;
+  }
+  pthread_mutex_lock(&timer_mutex);
+  timers.cancel(slot);
+  pthread_mutex_unlock(&timer_mutex);
+  slot = 0;
+}
+
+void ServerApp::armTurnTimer(GameSession *game) {
+  Player *player = players.get(game->players[game->turn]);
+  if (options.turnTimeoutSec <= 0 || !player) {
+    return;
+  }
+  uint64_t delayMs = options.turnTimeoutSec * 1000ull;
+  game->turnDeadlineMs = nowMs() + delayMs;
+  armTimer(game->turnTimer, TIMER_TURN, player, delayMs);
+}
+
+void ServerApp::expireTimers() {
+  pthread_mutex_lock(&timer_mutex);
+  timers.advance(nowMs(), expiredTimers);
+  size_t armed = timers.size();
+  pthread_mutex_unlock(&timer_mutex);
+  metrics.setGauge(GAUGE_ARMED_TIMERS, armed);
+
+  if (expiredTimers.empty()) {
+    return;
+  }
+
+  // Routed by session like the player's own packets, so an expiry is handled
+  // in order with them.
+  for (const TimerWheel::Expired &expired : expiredTimers) {
+    Packet pkt;
+    pkt.type = TIMER_EXPIRED;
+    pkt.session = expired.target;
+    pkt.x = expired.kind;
+    expiredPackets.push_back(pkt);
+  }
+  expiredTimers.clear();
+  routePackets(expiredPackets);
+  expiredPackets.clear();
+}
+
+void ServerApp::handleTimerExpired(Packet &pkt) {
+  Player *player = findPlayer(pkt.sender);
+  if (!player) {
+    return;
+  }
+  if (pkt.x == TIMER_TURN) {
+    handleTurnTimeout(player);
+  } else if (pkt.x == TIMER_IDLE) {
+    handleIdleTimeout(player);
+  }
+}
+
+void ServerApp::handleTurnTimeout(Player *player) {
+  // A shot may have re-armed the timer after this one fired.
+  GameSession *game = games.get(player->game);
+  if (!game || game->players[game->turn] != player->handle ||
+      nowMs() < game->turnDeadlineMs) {
+    return;
+  }
+  game->turnTimer = 0;
+  metrics.count(CNT_TURN_TIMEOUTS);
+
+  Packet losePkt;
+  losePkt.type = S_GAME_OVER;
+  strcpy(losePkt.payload, "Time is up!\n YOU LOST!");
+  sendToClient(player->login, losePkt);
 
-  if (quittingPlayer && quittingPlayer->inGame) {
-    Player *opponent = findPlayer(quittingPlayer->opponent);
-    if (opponent) {
-      Packet winPkt;
-      winPkt.type = S_GAME_OVER;
-      strcpy(winPkt.payload, "Opponent left the game.\n YOU WON!");
-      sendToClient(opponent->login, winPkt);
-
-      opponent->inGame = false;
-      opponent->gameName = "";
-      opponent->opponent = "";
-      opponent->isTurn = false;
-      
-      updateStatsAfterGame(opponent->login, quittingPlayer->login);
+  Player *opponent = players.get(game->players[1 - game->turn]);
+  logger.log(LOG_INFO, EV_TURN_TIMEOUT, player->login,
+             opponent ? opponent->login : std::string(), game->name);
+  forfeitGame(player, "Opponent ran out of time.\n YOU WON!");
+}
+
+void ServerApp::handleIdleTimeout(Player *player) {
+  player->idleTimer = 0;
+  uint64_t idleMs = options.idleTimeoutSec * 1000ull;
+  uint64_t silentMs = nowMs() - player->lastSeenMs;
+
+  // Packets only stamp lastSeenMs, so a live client's timer fires early and
+  // is pushed back here instead of being re-armed on every packet.
+  if (silentMs < idleMs) {
+    armTimer(player->idleTimer, TIMER_IDLE, player, idleMs - silentMs);
+    return;
+  }
+
+  metrics.count(CNT_IDLE_TIMEOUTS);
+  logger.log(LOG_INFO, EV_IDLE_TIMEOUT, player->login, {}, {}, 0, 0,
+             silentMs / 1000);
+
+  Packet bye;
+  bye.type = S_MSG;
+  strcpy(bye.payload, "Disconnected after a long silence. Please log in again.");
+  sendToClient(player->login, bye);
+
+  // Logging out forfeits a running game like a /quit would.
+  Packet logout;
+  logout.type = LOGOUT;
+  strncpy(logout.sender, player->login.c_str(), sizeof(logout.sender) - 1);
+  handleLogout(logout);
+}
+
+void ServerApp::startWorkers() {
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  int count = cores > 0 ? (int)cores : 1;
+
+  workers.resize(count);
+  routed.resize(count);
+  for (auto &worker : workers) {
+    worker.app = this;
+    pthread_mutex_init(&worker.mutex, nullptr);
+    pthread_cond_init(&worker.cond, nullptr);
+    if (pthread_create(&worker.thread, nullptr, workerThreadWrapper,
+                       &worker) != 0) {
+      std::cerr << "Fatal: Unable to start worker thread." << std::endl;
+      exit(1);
     }
   }
+  std::cout << "Started " << count << " worker threads." << std::endl;
+}
 
-  auto it =
-      std::remove_if(players.begin(), players.end(),
-                     [&](const Player &p) { return p.login == pkt.sender; });
+void ServerApp::stopWorkers() {
+  for (auto &worker : workers) {
+    pthread_mutex_lock(&worker.mutex);
+    isRunning = false;
+    pthread_cond_signal(&worker.cond);
+    pthread_mutex_unlock(&worker.mutex);
+  }
+  for (auto &worker : workers) {
+    pthread_join(worker.thread, nullptr);
+    pthread_mutex_destroy(&worker.mutex);
+    pthread_cond_destroy(&worker.cond);
+  }
+  workers.clear();
+  routed.clear();
+}
+
+void *ServerApp::workerThreadWrapper(void *context) {
+  Worker *worker = (Worker *)context;
+  worker->app->workerLoop(*worker);
+  return nullptr;
+}
+
+void ServerApp::workerLoop(Worker &worker) {
+  std::vector<QueuedPacket> batch;
+  while (true) {
+    pthread_mutex_lock(&worker.mutex);
+    while (worker.queue.empty() && isRunning) {
+      pthread_cond_wait(&worker.cond, &worker.mutex);
+    }
+    if (worker.queue.empty()) {
+      pthread_mutex_unlock(&worker.mutex);
+      break;
+    }
+    batch.swap(worker.queue);
+    pthread_mutex_unlock(&worker.mutex);
 
-  if (it != players.end()) {
-    players.erase(it, players.end());
-    std::cout << "[Logout] Player " << pkt.sender
-              << " removed from server's list.\n";
+    processBatch(batch);
+    batch.clear();
   }
 }
 
-void ServerApp::run() {
-  serverPipe.removePipe();
-  if (!serverPipe.create()) {
-    std::cerr << "Fatal: Unable to create server pipe. Check access rights."
+void ServerApp::startMatcher() {
+  matcherRunning = true;
+  if (pthread_create(&matcher, nullptr, matcherThreadWrapper, this) != 0) {
+    std::cerr << "Fatal: Unable to start matchmaking thread." << std::endl;
+    exit(1);
+  }
+}
+
+void ServerApp::stopMatcher() {
+  pthread_mutex_lock(&matcher_mutex);
+  matcherRunning = false;
+  pthread_cond_signal(&matcher_cond);
+  pthread_mutex_unlock(&matcher_mutex);
+  pthread_join(matcher, nullptr);
+}
+
+void *ServerApp::matcherThreadWrapper(void *context) {
+  ((ServerApp *)context)->matcherLoop();
+  return nullptr;
+}
+
+void ServerApp::matcherLoop() {
+  // Players not paired yet; only this thread touches the list.
+  std::vector<QueueEntry> waiting;
+  std::vector<StatsRecord> mail;
+  bool sharded = options.shardCount > 1;
+
+  pthread_mutex_lock(&matcher_mutex);
+  while (matcherRunning) {
+    timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += MATCH_INTERVAL_MS * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+      deadline.tv_sec += 1;
+      deadline.tv_nsec -= 1000000000L;
+    }
+    pthread_cond_timedwait(&matcher_cond, &matcher_mutex, &deadline);
+    pthread_mutex_unlock(&matcher_mutex);
+
+    matchmaker.takeAll(waiting);
+    // A sharded server also has offers, guests and mail to look after.
+    if (waiting.size() >= 2 || sharded) {
+      matchPlayers(waiting);
+    }
+    if (sharded) {
+      deliverMail(mail);
+    }
+    // Off the handler threads, which only mark compaction due.
+    stats.compactIfDue();
+
+    pthread_mutex_lock(&matcher_mutex);
+  }
+  pthread_mutex_unlock(&matcher_mutex);
+}
+
+void ServerApp::matchPlayers(std::vector<QueueEntry> &waiting) {
+  pthread_rwlock_wrlock(&list_lock);
+
+  // Drop players who left the queue or logged out since they queued.
+  std::vector<unsigned int> gone;
+  size_t live = 0;
+  for (const QueueEntry &entry : waiting) {
+    Player *player = players.get(entry.handle);
+    if (player && player->sessionId == entry.sessionId && player->queued &&
+        player->queueTicket == entry.ticket) {
+      waiting[live++] = entry;
+    } else {
+      gone.push_back(entry.ticket);
+    }
+  }
+  waiting.resize(live);
+
+  uint64_t now = Metrics::nowNs();
+  std::vector<std::pair<QueueEntry, QueueEntry>> pairs;
+  if (options.shardCount > 1) {
+    // The directory stays locked from taking the claims to posting new
+    // offers, so no offer is claimed while its player is paired here.
+    directory.lock();
+    for (unsigned int ticket : gone) {
+      directory.withdraw(ticket);
+    }
+    takeClaimedOffers(waiting);
+    Matchmaker::pair(waiting, options.ratedMatching, now, pairs);
+    for (const auto &match : pairs) {
+      directory.withdraw(match.first.ticket);
+      directory.withdraw(match.second.ticket);
+    }
+    offerAcrossShards(waiting, now);
+    directory.unlock();
+    expireGuests(now);
+  } else {
+    Matchmaker::pair(waiting, options.ratedMatching, now, pairs);
+  }
+
+  for (const auto &match : pairs) {
+    // Both wait for the next tick if every session is taken.
+    if (games.full()) {
+      waiting.push_back(match.first);
+      waiting.push_back(match.second);
+      continue;
+    }
+    Player *player1 = players.get(match.first.handle);
+    Player *player2 = players.get(match.second.handle);
+    leaveQueue(player1);
+    leaveQueue(player2);
+    startGame(player1, player2, "match-" + std::to_string(nextMatchId++));
+  }
+
+  pthread_rwlock_unlock(&list_lock);
+}
+
+void ServerApp::takeClaimedOffers(std::vector<QueueEntry> &waiting) {
+  std::vector<ShardOffer> claimed;
+  directory.takeClaimed(claimed);
+  for (const ShardOffer &offer : claimed) {
+    auto it = std::find_if(waiting.begin(), waiting.end(),
+                           [&](const QueueEntry &entry) {
+                             return entry.ticket == offer.ticket;
+                           });
+    // A player who left the queue meanwhile is not sent; the host gives up
+    // on the guest after GUEST_WAIT_NS.
+    if (it == waiting.end()) {
+      continue;
+    }
+    Player *player = players.get(it->handle);
+    waiting.erase(it);
+
+    sendRedirect(player->login, offer.hostShard, REDIRECT_MATCH,
+                 "Opponent found on another server, reconnecting...");
+    Packet logout;
+    logout.type = LOGOUT;
+    strncpy(logout.sender, player->login.c_str(), sizeof(logout.sender) - 1);
+    handleLogout(logout);
+  }
+}
+
+void ServerApp::offerAcrossShards(std::vector<QueueEntry> &waiting,
+                                  uint64_t nowNs) {
+  for (size_t i = 0; i < waiting.size();) {
+    const QueueEntry &entry = waiting[i];
+    if (nowNs - entry.enqueuedNs < CROSS_SHARD_WAIT_NS) {
+      ++i;
+      continue;
+    }
+
+    Player *player = players.get(entry.handle);
+    ShardOffer offer;
+    if (!directory.claim(entry.rating, options.ratedMatching, offer)) {
+      directory.post(player->login, entry.ticket, entry.rating,
+                     entry.enqueuedNs);
+      ++i;
+      continue;
+    }
+
+    // The player stays queued until the guest arrives, so /leave still
+    // works; startGuestGame() checks the ticket.
+    directory.withdraw(entry.ticket);
+    pendingGuests[offer.login] =
+        PendingGuest{player->handle, player->sessionId, entry.ticket,
+                     entry.rating, "match-" + std::to_string(nextMatchId++),
+                     nowNs + GUEST_WAIT_NS};
+    Packet found;
+    found.type = S_MSG;
+    strcpy(found.payload, "Opponent found on another server, waiting for "
+                          "them to connect...");
+    sendToClient(player->login, found);
+    waiting.erase(waiting.begin() + i);
+  }
+}
+
+void ServerApp::expireGuests(uint64_t nowNs) {
+  for (auto it = pendingGuests.begin(); it != pendingGuests.end();) {
+    const PendingGuest &pending = it->second;
+    if (nowNs < pending.expiresNs) {
+      ++it;
+      continue;
+    }
+
+    Player *host = players.get(pending.hostHandle);
+    if (host && host->sessionId == pending.hostSession && host->queued &&
+        host->queueTicket == pending.hostTicket) {
+      matchmaker.push(QueueEntry{host->handle, host->sessionId,
+                                 host->queueTicket, pending.hostRating,
+                                 nowNs});
+      Packet err;
+      err.type = S_MSG;
+      strcpy(err.payload, "Opponent did not connect. Still looking...");
+      sendToClient(host->login, err);
+    }
+    it = pendingGuests.erase(it);
+  }
+}
+
+void ServerApp::startGuestGame(Player *guest, const PendingGuest &pending) {
+  Player *host = players.get(pending.hostHandle);
+  if (!host || host->sessionId != pending.hostSession || !host->queued ||
+      host->queueTicket != pending.hostTicket) {
+    sendHome(guest, "Your opponent is gone, going back...");
+    return;
+  }
+
+  if (games.full()) {
+    sendHome(guest, "The server is full, going back...");
+    matchmaker.push(QueueEntry{host->handle, host->sessionId,
+                               host->queueTicket, pending.hostRating,
+                               Metrics::nowNs()});
+    return;
+  }
+
+  leaveQueue(host);
+  startGame(host, guest, pending.gameName);
+}
+
+bool ServerApp::redirectGuestHome(Packet &pkt) {
+  Player *player = findPlayer(pkt.sender);
+  if (!player || player->homeShard == options.shardIndex ||
+      player->game != NO_GAME) {
+    return false;
+  }
+  // Already on its way home, this request crossed the redirect.
+  if (!player->sentHome) {
+    sendHome(player, "Going back to your home server...");
+  }
+  return true;
+}
+
+void ServerApp::sendRedirect(const std::string &login, int shard,
+                             RedirectReason reason, const char *message) {
+  Packet redirect;
+  redirect.type = S_REDIRECT;
+  redirect.x = shard;
+  redirect.y = reason;
+  strncpy(redirect.payload, message, sizeof(redirect.payload) - 1);
+  sendToClient(login, redirect);
+
+  logger.log(LOG_INFO, EV_REDIRECTED, login, {}, {}, shard, reason);
+}
+
+void ServerApp::sendHome(Player *guest, const char *message) {
+  guest->sentHome = true;
+  sendRedirect(guest->login, guest->homeShard, REDIRECT_HOME, message);
+}
+
+void ServerApp::recordResult(Player *player, bool won, uint32_t shots,
+                             uint32_t hits) {
+  StatsRecord delta = {};
+  strncpy(delta.login, player->login.c_str(), sizeof(delta.login) - 1);
+  delta.gamesPlayed = 1;
+  delta.wins = won ? 1 : 0;
+  delta.losses = won ? 0 : 1;
+  if (player->homeShard == options.shardIndex) {
+    stats.merge(delta);
+    return;
+  }
+
+  delta.totalShots = shots;
+  delta.hits = hits;
+  if (!directory.mail(player->homeShard, delta)) {
+    std::cerr << "[Error] Mailbox of shard " << player->homeShard
+              << " is full, the result of " << player->login << " is lost"
               << std::endl;
+  }
+  sendHome(player, "Going back to your home server...");
+}
+
+void ServerApp::deliverMail(std::vector<StatsRecord> &deltas) {
+  deltas.clear();
+  directory.takeMail(deltas);
+  for (const StatsRecord &delta : deltas) {
+    stats.merge(delta);
+  }
+}
+
+void ServerApp::routePackets(std::vector<Packet> &packets) {
+  // Routing by session keeps every player's packets in order on one worker.
+  // A login has no session yet, its sender name is the only key.
+  uint64_t now = Metrics::nowNs();
+  for (const Packet &pkt : packets) {
+    size_t key = pkt.type == LOGIN ? std::hash<std::string>()(pkt.sender)
+                                   : pkt.session;
+    routed[key % workers.size()].push_back({pkt, now});
+  }
+
+  // One lock and one wakeup per worker for the whole batch.
+  metrics.addGauge(GAUGE_INBOUND_BACKLOG, packets.size());
+  for (size_t i = 0; i < workers.size(); ++i) {
+    if (routed[i].empty()) {
+      continue;
+    }
+    Worker &worker = workers[i];
+    pthread_mutex_lock(&worker.mutex);
+    worker.queue.insert(worker.queue.end(), routed[i].begin(),
+                        routed[i].end());
+    pthread_cond_signal(&worker.cond);
+    pthread_mutex_unlock(&worker.mutex);
+    routed[i].clear();
+  }
+}
+
+bool ServerApp::needsExclusiveLock(int type) {
+  return type != SHOOT && type != GET_BOARD && type != ADMIN_METRICS &&
+         type != HEARTBEAT;
+}
+
+void ServerApp::processBatch(std::vector<QueuedPacket> &batch) {
+  uint64_t now = Metrics::nowNs();
+  metrics.addGauge(GAUGE_INBOUND_BACKLOG, -(int64_t)batch.size());
+  for (const QueuedPacket &queued : batch) {
+    metrics.recordQueueWait(now - queued.queuedNs);
+  }
+
+  // Consecutive packets that want the same lock mode share one acquisition.
+  size_t i = 0;
+  while (i < batch.size()) {
+    bool exclusive = needsExclusiveLock(batch[i].pkt.type);
+    size_t end = i + 1;
+    while (end < batch.size() && end - i < MAX_LOCKED_BATCH &&
+           needsExclusiveLock(batch[end].pkt.type) == exclusive) {
+      ++end;
+    }
+
+    if (exclusive) {
+      pthread_rwlock_wrlock(&list_lock);
+    } else {
+      pthread_rwlock_rdlock(&list_lock);
+    }
+    metrics.count(CNT_LIST_LOCKS);
+
+    for (; i < end; ++i) {
+      processPacket(batch[i].pkt);
+    }
+
+    // Lobby sizes only change under the write lock.
+    if (exclusive) {
+      metrics.setGauge(GAUGE_PLAYERS_ONLINE, players.size());
+      metrics.setGauge(GAUGE_OPEN_ROOMS, gameRooms.size());
+      metrics.setGauge(GAUGE_LOBBY_SIZE, lobbySubscribers.size());
+    }
+    pthread_rwlock_unlock(&list_lock);
+  }
+}
+
+void ServerApp::processPacket(Packet &pkt) {
+  uint64_t start = Metrics::nowNs();
+  if (pkt.type == LOGIN || resolveSender(pkt)) {
+    dispatchPacket(pkt);
+  } else {
+    metrics.count(CNT_PACKETS_REJECTED);
+  }
+  metrics.recordHandler(pkt.type, Metrics::nowNs() - start);
+}
+
+void ServerApp::dispatchPacket(Packet &pkt) {
+  // A guest is only here for its cross-shard game, the lobby is at home.
+  bool lobbyRequest = pkt.type == CREATE_GAME || pkt.type == JOIN_GAME ||
+                      pkt.type == QUEUE || pkt.type == GET_STATS ||
+                      pkt.type == GET_GAME_LIST;
+  if (lobbyRequest && options.shardCount > 1 && redirectGuestHome(pkt)) {
     return;
   }
 
-  if (!serverPipe.openPipe(O_RDWR)) {
-    std::cerr << "Fatal: Unable to open pipe." << std::endl;
+  switch (pkt.type) {
+  case LOGIN:
+    handleLogin(pkt);
+    break;
+  case CREATE_GAME:
+    handleCreateGame(pkt);
+    break;
+  case JOIN_GAME:
+    handleJoinGame(pkt);
+    break;
+  case LEAVE_GAME:
+    handleLeaveGame(pkt);
+    break;
+  case SHOOT:
+    handleShoot(pkt);
+    break;
+  case LOGOUT:
+    handleLogout(pkt);
+    break;
+  case GET_STATS:
+    handleGetStats(pkt);
+    break;
+  case GET_GAME_LIST:
+    sendGameList(pkt.sender, pkt.x);
+    break;
+  case GET_BOARD:
+    handleGetBoard(pkt);
+    break;
+  case ADMIN_METRICS:
+    handleAdminMetrics(pkt);
+    break;
+  case QUEUE:
+    handleQueue(pkt);
+    break;
+  case SPECTATE:
+    handleSpectate(pkt);
+    break;
+  case HEARTBEAT:
+    // Nothing to do; resolveSender already marked the player as alive.
+    break;
+  case TIMER_EXPIRED:
+    handleTimerExpired(pkt);
+    break;
+  }
+}
+
+void ServerApp::onPackets(std::vector<Packet> &packets) {
+  metrics.count(CNT_PACKETS_IN, packets.size());
+  metrics.count(CNT_INBOUND_BATCHES);
+  routePackets(packets);
+}
+
+void ServerApp::run() {
+  if (!stats.open()) {
+    std::cerr << "Fatal: Unable to load player statistics." << std::endl;
     return;
   }
+  std::cout << "Loaded statistics of " << stats.size() << " players."
+            << std::endl;
 
-  std::cout << "Server running. Waiting..." << std::endl;
+  if (options.shardCount > 1 &&
+      !directory.open(options.shardCount, options.shardIndex)) {
+    stats.close();
+    return;
+  }
 
-  Packet pkt;
-  while (serverPipe.receive(&pkt, sizeof(Packet))) {
-    pthread_mutex_lock(&list_mutex);
+  transport.setShard(options.shardIndex);
+  if (!transport.open()) {
+    directory.close();
+    stats.close();
+    return;
+  }
 
-    switch (pkt.type) {
-    case LOGIN:
-      handleLogin(pkt);
-      break;
-    case CREATE_GAME:
-      handleCreateGame(pkt);
-      break;
-    case JOIN_GAME:
-      handleJoinGame(pkt);
-      break;
-    case LEAVE_GAME:
-      handleLeaveGame(pkt);
-      break;
-    case SHOOT:
-      handleShoot(pkt);
-      break;
-    case LOGOUT:
-      handleLogout(pkt);
-      break;
-    case GET_STATS:
-      handleGetStats(pkt);
-      break;
-    case GET_GAME_LIST:
-      sendGameList(pkt.sender);
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = handleStopSignal;
+  sigaction(SIGINT, &sa, nullptr);
+  sigaction(SIGTERM, &sa, nullptr);
+
+  // Background threads inherit a mask without the stop signals, so the
+  // signals always land on the event loop thread and interrupt its wait.
+  sigset_t stopSignals, previous;
+  sigemptyset(&stopSignals);
+  sigaddset(&stopSignals, SIGINT);
+  sigaddset(&stopSignals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &stopSignals, &previous);
+  logger.start();
+  spectators.start();
+  startWorkers();
+  startMatcher();
+  metrics.startDumper(options.metricsFile, options.metricsIntervalSec);
+  pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+
+  if (options.shardCount > 1) {
+    std::cout << "Serving shard " << options.shardIndex << " of "
+              << options.shardCount << "." << std::endl;
+  }
+  std::cout << "Server running with seed " << options.seed << ". Waiting..."
+            << std::endl;
+
+  // With timers in use the loop wakes every tick to advance the wheel.
+  bool useTimers = options.turnTimeoutSec > 0 || options.idleTimeoutSec > 0;
+  int pollTimeoutMs = useTimers ? TIMER_TICK_MS : -1;
+  while (isRunning && !stopRequested) {
+    if (!transport.poll(pollTimeoutMs, *this)) {
       break;
     }
-
-    pthread_mutex_unlock(&list_mutex);
+    if (useTimers) {
+      expireTimers();
+    }
   }
 
-  serverPipe.closePipe();
-  serverPipe.removePipe();
+  std::cout << "Shutting down..." << std::endl;
+  stopWorkers();
+  stopMatcher();
+  spectators.stop();
+  logger.stop();
+  metrics.stopDumper();
+  transport.close();
+  directory.close();
+  stats.close();
 }
@@ -0,0 +1,255 @@
+#include "ShardDirectory.h"
+
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <new>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const uint32_t DIRECTORY_MAGIC = 0x53444931;
+
+// How long a server waits for another one to finish creating the segment.
+static const int ATTACH_WAIT_MS = 2000;
+
+ShardDirectory::ShardDirectory() : segment(nullptr), shard(0) {}
+
+ShardDirectory::~ShardDirectory() { close(); }
+
+bool ShardDirectory::open(int shardCount, int index) {
+  shard = index;
+
+  bool created = true;
+  int fd = shm_open(SHARD_DIRECTORY_SEGMENT, O_CREAT | O_EXCL | O_RDWR, 0666);
+  if (fd == -1 && errno == EEXIST) {
+    created = false;
+    fd = shm_open(SHARD_DIRECTORY_SEGMENT, O_RDWR, 0);
+  }
+  if (fd == -1) {
+    std::cerr << "Fatal: Unable to open the shard directory: "
+              << strerror(errno) << std::endl;
+    return false;
+  }
+
+  if (created) {
+    if (ftruncate(fd, sizeof(Segment)) == -1) {
+      std::cerr << "Fatal: Unable to size the shard directory: "
+                << strerror(errno) << std::endl;
+      ::close(fd);
+      shm_unlink(SHARD_DIRECTORY_SEGMENT);
+      return false;
+    }
+  } else {
+    // The creator may not have sized it yet.
+    struct stat st;
+    for (int waited = 0;
+         fstat(fd, &st) == 0 && st.st_size < (off_t)sizeof(Segment);
+         waited += 10) {
+      if (waited >= ATTACH_WAIT_MS) {
+        std::cerr << "Fatal: The shard directory " << SHARD_DIRECTORY_SEGMENT
+                  << " is incomplete, remove it from /dev/shm." << std::endl;
+        ::close(fd);
+        return false;
+      }
+      usleep(10000);
+    }
+  }
+
+  void *addr =
+      mmap(nullptr, sizeof(Segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (addr == MAP_FAILED) {
+    std::cerr << "Fatal: Unable to map the shard directory: "
+              << strerror(errno) << std::endl;
+    return false;
+  }
+
+  if (created) {
+    // ftruncate() zero-fills: no pids, no offers, empty mailboxes.
+    segment = new (addr) Segment();
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&segment->mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+    segment->shardCount = shardCount;
+    segment->magic.store(DIRECTORY_MAGIC, std::memory_order_release);
+  } else {
+    segment = (Segment *)addr;
+    for (int waited = 0;
+         segment->magic.load(std::memory_order_acquire) != DIRECTORY_MAGIC;
+         waited += 10) {
+      if (waited >= ATTACH_WAIT_MS) {
+        std::cerr << "Fatal: The shard directory " << SHARD_DIRECTORY_SEGMENT
+                  << " is incomplete, remove it from /dev/shm." << std::endl;
+        munmap(segment, sizeof(Segment));
+        segment = nullptr;
+        return false;
+      }
+      usleep(10000);
+    }
+  }
+
+  if (segment->shardCount != shardCount) {
+    std::cerr << "Fatal: The shard directory was set up for "
+              << segment->shardCount << " shards, not " << shardCount
+              << ". Stop all servers and remove " << SHARD_DIRECTORY_SEGMENT
+              << " from /dev/shm." << std::endl;
+    close();
+    return false;
+  }
+
+  lock();
+  if (isAlive(shard) && segment->pids[shard] != getpid()) {
+    pid_t owner = segment->pids[shard];
+    unlock();
+    std::cerr << "Fatal: Shard " << shard << " is already served by process "
+              << owner << "." << std::endl;
+    close();
+    return false;
+  }
+  segment->pids[shard] = getpid();
+  // Offers of a previous run of this shard refer to tickets that are gone.
+  for (ShardOffer &offer : segment->offers) {
+    if (offer.state != OFFER_FREE &&
+        (offer.homeShard == shard ||
+         (offer.state == OFFER_CLAIMED && offer.hostShard == shard))) {
+      offer.state = OFFER_FREE;
+    }
+  }
+  unlock();
+  return true;
+}
+
+void ShardDirectory::close() {
+  if (!segment) {
+    return;
+  }
+  lock();
+  if (segment->pids[shard] == getpid()) {
+    segment->pids[shard] = 0;
+  }
+  unlock();
+  munmap(segment, sizeof(Segment));
+  segment = nullptr;
+}
+
+// Robust, so a server that died holding the lock does not wedge the others.
+void ShardDirectory::lock() {
+  if (pthread_mutex_lock(&segment->mutex) == EOWNERDEAD) {
+    pthread_mutex_consistent(&segment->mutex);
+  }
+}
+
+void ShardDirectory::unlock() { pthread_mutex_unlock(&segment->mutex); }
+
+bool ShardDirectory::isAlive(int other) {
+  pid_t pid = segment->pids[other];
+  return pid > 0 && (kill(pid, 0) == 0 || errno == EPERM);
+}
+
+void ShardDirectory::takeClaimed(std::vector<ShardOffer> &claimed) {
+  for (ShardOffer &offer : segment->offers) {
+    if (offer.state == OFFER_CLAIMED && offer.homeShard == shard) {
+      claimed.push_back(offer);
+      offer.state = OFFER_FREE;
+    }
+  }
+}
+
+bool ShardDirectory::post(const std::string &login, uint32_t ticket,
+                          int rating, uint64_t nowNs) {
+  ShardOffer *free = nullptr;
+  for (ShardOffer &offer : segment->offers) {
+    if (offer.state == OFFER_FREE) {
+      if (!free) {
+        free = &offer;
+      }
+    } else if (offer.homeShard == shard && offer.ticket == ticket) {
+      return true;
+    }
+  }
+  if (!free) {
+    return false;
+  }
+
+  memset(free, 0, sizeof(*free));
+  strncpy(free->login, login.c_str(), sizeof(free->login) - 1);
+  free->homeShard = shard;
+  free->ticket = ticket;
+  free->rating = rating;
+  free->postedNs = nowNs;
+  free->state = OFFER_OPEN;
+  return true;
+}
+
+void ShardDirectory::withdraw(uint32_t ticket) {
+  for (ShardOffer &offer : segment->offers) {
+    if (offer.state == OFFER_OPEN && offer.homeShard == shard &&
+        offer.ticket == ticket) {
+      offer.state = OFFER_FREE;
+      return;
+    }
+  }
+}
+
+bool ShardDirectory::claim(int rating, bool rated, ShardOffer &claimed) {
+  ShardOffer *best = nullptr;
+  bool alive[MAX_SHARDS] = {};
+  bool checked[MAX_SHARDS] = {};
+
+  for (ShardOffer &offer : segment->offers) {
+    if (offer.state != OFFER_OPEN || offer.homeShard == shard) {
+      continue;
+    }
+    int home = offer.homeShard;
+    if (!checked[home]) {
+      alive[home] = isAlive(home);
+      checked[home] = true;
+    }
+    if (!alive[home]) {
+      // Nobody is left to redirect the player.
+      offer.state = OFFER_FREE;
+      continue;
+    }
+    if (!best ||
+        (rated ? abs(offer.rating - rating) < abs(best->rating - rating)
+               : offer.postedNs < best->postedNs)) {
+      best = &offer;
+    }
+  }
+  if (!best) {
+    return false;
+  }
+
+  best->state = OFFER_CLAIMED;
+  best->hostShard = shard;
+  claimed = *best;
+  return true;
+}
+
+bool ShardDirectory::mail(int to, const StatsRecord &delta) {
+  lock();
+  Mailbox &box = segment->mailboxes[to];
+  bool fits = box.tail - box.head < MAILBOX_SIZE;
+  if (fits) {
+    box.deltas[box.tail % MAILBOX_SIZE] = delta;
+    box.tail++;
+  }
+  unlock();
+  return fits;
+}
+
+void ShardDirectory::takeMail(std::vector<StatsRecord> &deltas) {
+  lock();
+  Mailbox &box = segment->mailboxes[shard];
+  for (; box.head != box.tail; ++box.head) {
+    deltas.push_back(box.deltas[box.head % MAILBOX_SIZE]);
+  }
+  unlock();
+}
@@ -0,0 +1,192 @@
+#include "SpectatorHub.h"
+#include "wire.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+SpectatorHub::SpectatorHub(ServerTransport &transport, Metrics &metrics,
+                           int games)
+    : transport(transport), metrics(metrics),
+      audience(new std::atomic<int>[games > 0 ? games : 1]),
+      gameCount(games > 0 ? games : 1), running(false) {
+  for (int i = 0; i < gameCount; ++i) {
+    audience[i].store(0, std::memory_order_relaxed);
+  }
+  pthread_mutex_init(&mutex, nullptr);
+  pthread_cond_init(&cond, nullptr);
+
+  Packet notice;
+  notice.type = S_MSG;
+  strcpy(notice.payload, "You fell too far behind and stopped watching.");
+  char frame[MAX_FRAME_SIZE];
+  droppedNotice = std::make_shared<const std::string>(
+      frame, encodeFrame(notice, frame));
+}
+
+SpectatorHub::~SpectatorHub() {
+  pthread_mutex_destroy(&mutex);
+  pthread_cond_destroy(&cond);
+}
+
+void SpectatorHub::start() {
+  running = true;
+  if (pthread_create(&thread, nullptr, threadWrapper, this) != 0) {
+    std::cerr << "Fatal: Unable to start spectator thread." << std::endl;
+    exit(1);
+  }
+}
+
+void SpectatorHub::stop() {
+  pthread_mutex_lock(&mutex);
+  running = false;
+  pthread_cond_signal(&cond);
+  pthread_mutex_unlock(&mutex);
+  pthread_join(thread, nullptr);
+}
+
+void SpectatorHub::subscribe(int game, const std::string &login) {
+  if (game < 0 || game >= gameCount) {
+    return;
+  }
+  // Counted right away, so events published before the thread gets to the
+  // request are not skipped by watched().
+  audience[game].fetch_add(1, std::memory_order_release);
+  push(Request{REQ_SUBSCRIBE, game, login, nullptr});
+}
+
+void SpectatorHub::unsubscribe(const std::string &login) {
+  push(Request{REQ_UNSUBSCRIBE, NO_GAME, login, nullptr});
+}
+
+void SpectatorHub::close(int game) {
+  if (game >= 0 && game < gameCount && watched(game)) {
+    push(Request{REQ_CLOSE, game, std::string(), nullptr});
+  }
+}
+
+void SpectatorHub::publish(int game, const Packet &pkt) {
+  if (game < 0 || game >= gameCount || !watched(game)) {
+    return;
+  }
+  char frame[MAX_FRAME_SIZE];
+  size_t frameSize = encodeFrame(pkt, frame);
+  push(Request{REQ_PUBLISH, game, std::string(),
+               std::make_shared<const std::string>(frame, frameSize)});
+}
+
+void SpectatorHub::push(Request request) {
+  pthread_mutex_lock(&mutex);
+  queue.push_back(std::move(request));
+  pthread_cond_signal(&cond);
+  pthread_mutex_unlock(&mutex);
+}
+
+void *SpectatorHub::threadWrapper(void *context) {
+  ((SpectatorHub *)context)->hubLoop();
+  return nullptr;
+}
+
+void SpectatorHub::hubLoop() {
+  std::vector<Request> batch;
+  pthread_mutex_lock(&mutex);
+  while (true) {
+    while (running && queue.empty()) {
+      pthread_cond_wait(&cond, &mutex);
+    }
+    if (queue.empty()) {
+      break;
+    }
+    batch.swap(queue);
+    pthread_mutex_unlock(&mutex);
+
+    for (Request &request : batch) {
+      apply(request);
+    }
+    batch.clear();
+
+    pthread_mutex_lock(&mutex);
+  }
+  pthread_mutex_unlock(&mutex);
+}
+
+void SpectatorHub::apply(Request &request) {
+  switch (request.kind) {
+  case REQ_SUBSCRIBE:
+    remove(request.login);
+    spectatorsByGame[request.game].push_back(request.login);
+    gameBySpectator[request.login] = request.game;
+    metrics.addGauge(GAUGE_SPECTATORS, 1);
+    break;
+  case REQ_UNSUBSCRIBE:
+    remove(request.login);
+    break;
+  case REQ_CLOSE: {
+    auto it = spectatorsByGame.find(request.game);
+    if (it == spectatorsByGame.end()) {
+      break;
+    }
+    for (const std::string &login : it->second) {
+      gameBySpectator.erase(login);
+    }
+    int count = (int)it->second.size();
+    audience[request.game].fetch_sub(count, std::memory_order_release);
+    metrics.addGauge(GAUGE_SPECTATORS, -count);
+    spectatorsByGame.erase(it);
+    break;
+  }
+  case REQ_PUBLISH:
+    deliver(request.game, request.frame);
+    break;
+  }
+}
+
+void SpectatorHub::remove(const std::string &login) {
+  auto entry = gameBySpectator.find(login);
+  if (entry == gameBySpectator.end()) {
+    return;
+  }
+  int game = entry->second;
+  gameBySpectator.erase(entry);
+
+  std::vector<std::string> &spectators = spectatorsByGame[game];
+  for (size_t i = 0; i < spectators.size(); ++i) {
+    if (spectators[i] == login) {
+      spectators[i] = std::move(spectators.back());
+      spectators.pop_back();
+      break;
+    }
+  }
+  if (spectators.empty()) {
+    spectatorsByGame.erase(game);
+  }
+  audience[game].fetch_sub(1, std::memory_order_release);
+  metrics.addGauge(GAUGE_SPECTATORS, -1);
+}
+
+void SpectatorHub::deliver(int game, const SharedFrame &frame) {
+  auto it = spectatorsByGame.find(game);
+  if (it == spectatorsByGame.end()) {
+    return;
+  }
+
+  std::vector<std::string> &spectators = it->second;
+  for (size_t i = 0; i < spectators.size();) {
+    if (transport.sendShared(spectators[i], frame, MAX_BACKLOG)) {
+      metrics.count(CNT_FRAMES_OUT);
+      ++i;
+      continue;
+    }
+    // Too far behind (or gone): stop watching rather than wait for it.
+    transport.sendShared(spectators[i], droppedNotice, MAX_BACKLOG + 1);
+    metrics.count(CNT_SPECTATORS_DROPPED);
+    gameBySpectator.erase(spectators[i]);
+    spectators[i] = std::move(spectators.back());
+    spectators.pop_back();
+    audience[game].fetch_sub(1, std::memory_order_release);
+    metrics.addGauge(GAUGE_SPECTATORS, -1);
+  }
+  if (spectators.empty()) {
+    spectatorsByGame.erase(it);
+  }
+}
@@ -0,0 +1,513 @@
+#include "StatsStore.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <libgen.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+static const uint32_t SNAPSHOT_MAGIC = 0x53545331;
+static const uint32_t SNAPSHOT_VERSION = 1;
+static const uint32_t LOG_MAGIC = 0x4c4f4731;
+
+// The log is only compacted once it holds more entries than there are
+// players, and never for fewer than this.
+static const size_t COMPACT_MIN_ENTRIES = 64 * 1024;
+
+struct SnapshotHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t count;
+};
+
+static_assert(sizeof(StatsRecord) == 52, "StatsRecord is an on-disk format");
+
+static bool writeAll(int fd, const void *data, size_t size) {
+  const char *p = (const char *)data;
+  while (size > 0) {
+    ssize_t n = write(fd, p, size);
+    if (n == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+StatsStore::StatsStore(const std::string &path)
+    : snapshotPath(path + ".dat"), logPath(path + ".log"), snapshot(nullptr),
+      snapshotCount(0), mappedSize(0), indexed(0), logFd(-1), logEntries(0),
+      logBuffered(0), compactionDue(false) {
+  mutex = PTHREAD_MUTEX_INITIALIZER;
+}
+
+StatsStore::~StatsStore() {
+  close();
+  pthread_mutex_destroy(&mutex);
+}
+
+bool StatsStore::mapSnapshot() {
+  int fd = ::open(snapshotPath.c_str(), O_RDONLY);
+  if (fd == -1) {
+    return errno == ENOENT;
+  }
+
+  struct stat st;
+  SnapshotHeader header;
+  if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(header) ||
+      pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+      header.magic != SNAPSHOT_MAGIC || header.version != SNAPSHOT_VERSION ||
+      sizeof(header) + header.count * sizeof(StatsRecord) >
+          (size_t)st.st_size) {
+    std::cerr << "[Error] " << snapshotPath << " is not a valid stats snapshot"
+              << std::endl;
+    ::close(fd);
+    return false;
+  }
+
+  // Private mapping: updates stay in memory and reach the disk through the
+  // log, so the snapshot only ever changes by being replaced.
+  void *base = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                    fd, 0);
+  ::close(fd);
+  if (base == MAP_FAILED) {
+    std::cerr << "[Error] Unable to map " << snapshotPath << ": "
+              << strerror(errno) << std::endl;
+    return false;
+  }
+
+  mappedSize = st.st_size;
+  snapshotCount = header.count;
+  snapshot = (StatsRecord *)((char *)base + sizeof(header));
+  return true;
+}
+
+void StatsStore::unmapSnapshot() {
+  if (snapshot) {
+    munmap((char *)snapshot - sizeof(SnapshotHeader), mappedSize);
+    snapshot = nullptr;
+  }
+  snapshotCount = 0;
+  mappedSize = 0;
+}
+
+void StatsStore::replayLog() {
+  std::vector<char> chunk(4096 * sizeof(LogEntry));
+  off_t validEnd = 0;
+  size_t pending = 0;
+  bool corrupt = false;
+
+  while (!corrupt) {
+    ssize_t n = read(logFd, chunk.data() + pending, chunk.size() - pending);
+    if (n <= 0) {
+      break;
+    }
+    pending += n;
+
+    size_t offset = 0;
+    for (; pending - offset >= sizeof(LogEntry); offset += sizeof(LogEntry)) {
+      LogEntry entry;
+      memcpy(&entry, chunk.data() + offset, sizeof(entry));
+      if (entry.magic != LOG_MAGIC) {
+        corrupt = true;
+        break;
+      }
+      *findOrCreate(std::string(loginOf(entry.record))) = entry.record;
+      ++logEntries;
+      validEnd += sizeof(LogEntry);
+    }
+    memmove(chunk.data(), chunk.data() + offset, pending - offset);
+    pending -= offset;
+  }
+
+  // Cut off a torn or corrupt tail, so new entries start on a boundary.
+  if (lseek(logFd, 0, SEEK_END) != validEnd) {
+    std::cerr << "[Warning] Discarding a damaged tail of " << logPath
+              << std::endl;
+    if (ftruncate(logFd, validEnd) == -1) {
+      std::cerr << "[Error] Unable to truncate " << logPath << ": "
+                << strerror(errno) << std::endl;
+    }
+  }
+}
+
+bool StatsStore::open() {
+  pthread_mutex_lock(&mutex);
+
+  bool ok = mapSnapshot();
+  if (ok) {
+    rehash(snapshotCount);
+    for (size_t i = 0; i < snapshotCount; ++i) {
+      insert((uint32_t)i);
+    }
+
+    logFd = ::open(logPath.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (logFd == -1) {
+      std::cerr << "[Error] Unable to open " << logPath << ": "
+                << strerror(errno) << std::endl;
+      ok = false;
+    } else {
+      replayLog();
+    }
+  }
+
+  pthread_mutex_unlock(&mutex);
+  return ok;
+}
+
+void StatsStore::close() {
+  pthread_mutex_lock(&mutex);
+  bool pending = logFd != -1 && (logEntries > 0 || logBuffered > 0);
+  pthread_mutex_unlock(&mutex);
+  // Leave a fresh snapshot behind so the next start has no log to replay.
+  if (pending) {
+    compact();
+  }
+
+  pthread_mutex_lock(&mutex);
+  if (logFd != -1) {
+    flushLog();
+    ::close(logFd);
+    logFd = -1;
+  }
+  unmapSnapshot();
+  added.clear();
+  slots.clear();
+  indexed = 0;
+  pthread_mutex_unlock(&mutex);
+}
+
+StatsRecord *StatsStore::record(uint32_t id) {
+  if (id < snapshotCount) {
+    return &snapshot[id];
+  }
+  return &added[id - snapshotCount];
+}
+
+std::string_view StatsStore::loginOf(const StatsRecord &rec) {
+  return std::string_view(rec.login, strnlen(rec.login, sizeof(rec.login)));
+}
+
+void StatsStore::rehash(size_t count) {
+  size_t capacity = 64;
+  while (capacity < 2 * count) {
+    capacity *= 2;
+  }
+  slots.assign(capacity, 0);
+  size_t total = indexed;
+  indexed = 0;
+  for (size_t id = 0; id < total; ++id) {
+    insert((uint32_t)id);
+  }
+}
+
+void StatsStore::insert(uint32_t id) {
+  if (2 * (indexed + 1) > slots.size()) {
+    rehash(2 * (indexed + 1));
+  }
+  size_t mask = slots.size() - 1;
+  size_t slot = std::hash<std::string_view>()(loginOf(*record(id))) & mask;
+  while (slots[slot] != 0) {
+    slot = (slot + 1) & mask;
+  }
+  slots[slot] = id + 1;
+  ++indexed;
+}
+
+StatsRecord *StatsStore::find(std::string_view login) {
+  if (slots.empty()) {
+    return nullptr;
+  }
+  size_t mask = slots.size() - 1;
+  size_t slot = std::hash<std::string_view>()(login) & mask;
+  while (slots[slot] != 0) {
+    StatsRecord *rec = record(slots[slot] - 1);
+    if (loginOf(*rec) == login) {
+      return rec;
+    }
+    slot = (slot + 1) & mask;
+  }
+  return nullptr;
+}
+
+StatsRecord *StatsStore::findOrCreate(const std::string &login) {
+  std::string_view key(login.data(),
+                       std::min(login.size(), sizeof(StatsRecord::login) - 1));
+  StatsRecord *rec = find(key);
+  if (rec) {
+    return rec;
+  }
+
+  StatsRecord fresh;
+  memset(&fresh, 0, sizeof(fresh));
+  memcpy(fresh.login, key.data(), key.size());
+  added.push_back(fresh);
+  insert((uint32_t)(snapshotCount + added.size() - 1));
+  return &added.back();
+}
+
+void StatsStore::flushLog() {
+  if (logBuffered == 0 || logFd == -1) {
+    return;
+  }
+  if (!writeAll(logFd, logBuffer, logBuffered)) {
+    std::cerr << "[Error] Unable to write " << logPath << ": "
+              << strerror(errno) << std::endl;
+  }
+  logBuffered = 0;
+}
+
+void StatsStore::append(const StatsRecord &rec) {
+  if (logBuffered + sizeof(LogEntry) > sizeof(logBuffer)) {
+    flushLog();
+  }
+  LogEntry entry;
+  entry.magic = LOG_MAGIC;
+  entry.record = rec;
+  memcpy(logBuffer + logBuffered, &entry, sizeof(entry));
+  logBuffered += sizeof(entry);
+  ++logEntries;
+
+  if (logEntries >= COMPACT_MIN_ENTRIES && logEntries > indexed) {
+    compactionDue = true;
+  }
+}
+
+void StatsStore::compactIfDue() {
+  pthread_mutex_lock(&mutex);
+  bool due = compactionDue;
+  pthread_mutex_unlock(&mutex);
+  if (due) {
+    compact();
+  }
+}
+
+// Writes header and records to a new snapshot file, fsyncs it and renames it
+// over the old one.
+bool StatsStore::writeSnapshot(const std::vector<StatsRecord> &records) {
+  std::string tmpPath = snapshotPath + ".tmp";
+  int fd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1) {
+    std::cerr << "[Error] Unable to create " << tmpPath << ": "
+              << strerror(errno) << std::endl;
+    return false;
+  }
+
+  SnapshotHeader header;
+  header.magic = SNAPSHOT_MAGIC;
+  header.version = SNAPSHOT_VERSION;
+  header.count = records.size();
+
+  bool ok = writeAll(fd, &header, sizeof(header)) &&
+            writeAll(fd, records.data(), records.size() * sizeof(StatsRecord));
+  ok = ok && fsync(fd) == 0;
+  ::close(fd);
+  if (!ok || rename(tmpPath.c_str(), snapshotPath.c_str()) == -1) {
+    std::cerr << "[Error] Unable to write " << snapshotPath << ": "
+              << strerror(errno) << std::endl;
+    unlink(tmpPath.c_str());
+    return false;
+  }
+
+  // The rename is only durable once the directory is synced. Until the log
+  // is replaced a crash simply replays it on top of the new snapshot; log
+  // entries are absolute values, so that is harmless.
+  std::vector<char> dir(snapshotPath.begin(), snapshotPath.end());
+  dir.push_back('\0');
+  int dirFd = ::open(dirname(dir.data()), O_RDONLY | O_DIRECTORY);
+  if (dirFd != -1) {
+    fsync(dirFd);
+    ::close(dirFd);
+  }
+  return true;
+}
+
+// Reads the log from offset from to its end. Expect mutex to be held and
+// the log buffer to be flushed.
+bool StatsStore::readLog(off_t from, std::vector<LogEntry> &entries) {
+  entries.clear();
+  off_t end = lseek(logFd, 0, SEEK_END);
+  if (end == -1) {
+    return false;
+  }
+  if (end > from) {
+    entries.resize((end - from) / sizeof(LogEntry));
+    size_t size = entries.size() * sizeof(LogEntry);
+    if (pread(logFd, entries.data(), size, from) != (ssize_t)size) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Replaces the log with tail, the entries the new snapshot does not hold.
+// Expect mutex to be held.
+void StatsStore::restartLog(const std::vector<LogEntry> &tail) {
+  // A new file synced and renamed into place: a crash leaves either the old
+  // log, which replays harmlessly over the new snapshot, or the whole tail.
+  std::string tmpPath = logPath + ".tmp";
+  int fd = ::open(tmpPath.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_APPEND,
+                  0644);
+  if (fd == -1 ||
+      !writeAll(fd, tail.data(), tail.size() * sizeof(LogEntry)) ||
+      fsync(fd) == -1 || rename(tmpPath.c_str(), logPath.c_str()) == -1) {
+    // The old log stays; it still holds every entry of the tail.
+    std::cerr << "[Error] Unable to replace " << logPath << ": "
+              << strerror(errno) << std::endl;
+    if (fd != -1) {
+      ::close(fd);
+      unlink(tmpPath.c_str());
+    }
+    return;
+  }
+  ::close(logFd);
+  logFd = fd;
+  logEntries = tail.size();
+}
+
+bool StatsStore::compact() {
+  // A copy of the records and the log position it covers, taken under the
+  // lock; the slow part runs without it.
+  pthread_mutex_lock(&mutex);
+  compactionDue = false;
+  if (logFd == -1) {
+    pthread_mutex_unlock(&mutex);
+    return false;
+  }
+  flushLog();
+  std::vector<StatsRecord> records(snapshot, snapshot + snapshotCount);
+  records.insert(records.end(), added.begin(), added.end());
+  off_t copiedEnd = lseek(logFd, 0, SEEK_END);
+  pthread_mutex_unlock(&mutex);
+
+  if (!writeSnapshot(records)) {
+    return false;
+  }
+
+  pthread_mutex_lock(&mutex);
+  // Entries logged since the copy, which the new snapshot lacks. Unless they
+  // can be read the old mapping stays in use, with the whole log; replaying
+  // that over the new snapshot after a restart is harmless.
+  flushLog();
+  std::vector<LogEntry> tail;
+  if (!readLog(copiedEnd, tail)) {
+    std::cerr << "[Error] Unable to read " << logPath << ": "
+              << strerror(errno) << std::endl;
+    pthread_mutex_unlock(&mutex);
+    return false;
+  }
+
+  // Records keep their ids, so the index stays valid across the swap: the
+  // copied ones move into the new mapping, later ones stay in added.
+  void *oldBase = snapshot ? (char *)snapshot - sizeof(SnapshotHeader) : nullptr;
+  size_t oldSize = mappedSize;
+  size_t oldCount = snapshotCount;
+  bool mapped = mapSnapshot();
+  if (mapped) {
+    if (oldBase) {
+      munmap(oldBase, oldSize);
+    }
+    added.erase(added.begin(), added.begin() + (snapshotCount - oldCount));
+    // Records changed since the copy hold newer values than the snapshot.
+    for (const LogEntry &entry : tail) {
+      *findOrCreate(std::string(loginOf(entry.record))) = entry.record;
+    }
+  }
+  // On failure the old mapping simply stays in use, with every record.
+  restartLog(tail);
+  size_t count = snapshotCount;
+  pthread_mutex_unlock(&mutex);
+
+  if (mapped) {
+    std::cout << "[Stats] Compacted " << count << " records into "
+              << snapshotPath << std::endl;
+  }
+  return mapped;
+}
+
+void StatsStore::recordShot(const std::string &login, bool hit) {
+  pthread_mutex_lock(&mutex);
+  StatsRecord *rec = findOrCreate(login);
+  rec->totalShots++;
+  if (hit) {
+    rec->hits++;
+  }
+  append(*rec);
+  pthread_mutex_unlock(&mutex);
+}
+
+void StatsStore::recordGame(const std::string &winner,
+                            const std::string &loser) {
+  pthread_mutex_lock(&mutex);
+  StatsRecord *winnerRec = findOrCreate(winner);
+  winnerRec->gamesPlayed++;
+  winnerRec->wins++;
+  append(*winnerRec);
+
+  StatsRecord *loserRec = findOrCreate(loser);
+  loserRec->gamesPlayed++;
+  loserRec->losses++;
+  append(*loserRec);
+
+  // Game results are what players care about, don't leave them buffered.
+  flushLog();
+  pthread_mutex_unlock(&mutex);
+}
+
+void StatsStore::merge(const StatsRecord &delta) {
+  std::string login(loginOf(delta));
+  pthread_mutex_lock(&mutex);
+  StatsRecord *rec = findOrCreate(login);
+  rec->gamesPlayed += delta.gamesPlayed;
+  rec->wins += delta.wins;
+  rec->losses += delta.losses;
+  rec->totalShots += delta.totalShots;
+  rec->hits += delta.hits;
+  append(*rec);
+  flushLog();
+  pthread_mutex_unlock(&mutex);
+}
+
+PlayerStats StatsStore::get(const std::string &login) {
+  PlayerStats stats;
+  stats.login = login;
+  stats.gamesPlayed = 0;
+  stats.wins = 0;
+  stats.losses = 0;
+  stats.totalShots = 0;
+  stats.hits = 0;
+  stats.accuracy = 0.0;
+
+  pthread_mutex_lock(&mutex);
+  const StatsRecord *rec = find(std::string_view(
+      login.data(), std::min(login.size(), sizeof(StatsRecord::login) - 1)));
+  if (rec) {
+    stats.gamesPlayed = rec->gamesPlayed;
+    stats.wins = rec->wins;
+    stats.losses = rec->losses;
+    stats.totalShots = rec->totalShots;
+    stats.hits = rec->hits;
+  }
+  pthread_mutex_unlock(&mutex);
+
+  if (stats.totalShots > 0) {
+    stats.accuracy = (double)stats.hits / stats.totalShots * 100;
+  }
+  return stats;
+}
+
+size_t StatsStore::size() {
+  pthread_mutex_lock(&mutex);
+  size_t count = indexed;
+  pthread_mutex_unlock(&mutex);
+  return count;
+}
@@ -0,0 +1,147 @@
+#include "TimerWheel.h"
+
+static const int32_t NONE = -1;
+
+TimerWheel::TimerWheel(uint64_t nowMs, int tickMs)
+    : tickMs(tickMs > 0 ? tickMs : 1), startMs(nowMs), currentTick(0),
+      armed(0) {
+  for (auto &level : heads) {
+    for (int32_t &head : level) {
+      head = NONE;
+    }
+  }
+}
+
+TimerWheel::TimerId TimerWheel::schedule(uint64_t nowMs, uint64_t delayMs,
+                                         int kind, uint32_t target) {
+  int32_t index;
+  if (!freeNodes.empty()) {
+    index = freeNodes.back();
+    freeNodes.pop_back();
+  } else {
+    index = (int32_t)nodes.size();
+    nodes.push_back(Node());
+    nodes[index].generation = 1;
+  }
+
+  // Rounded up so a timer never fires early, and never into the current
+  // tick, which has been run already.
+  Node &node = nodes[index];
+  uint64_t dueMs = nowMs + delayMs > startMs ? nowMs + delayMs - startMs : 0;
+  node.expiresTick = (dueMs + tickMs - 1) / tickMs;
+  if (node.expiresTick <= currentTick) {
+    node.expiresTick = currentTick + 1;
+  }
+  node.kind = kind;
+  node.target = target;
+  place(index);
+  armed++;
+  return ((uint64_t)node.generation << 32) | (uint32_t)index;
+}
+
+bool TimerWheel::cancel(TimerId id) {
+  uint32_t index = (uint32_t)id;
+  if (id == 0 || index >= nodes.size() ||
+      nodes[index].generation != (uint32_t)(id >> 32) ||
+      nodes[index].level < 0) {
+    return false;
+  }
+  unlink(index);
+  release(index);
+  return true;
+}
+
+void TimerWheel::place(int32_t index) {
+  Node &node = nodes[index];
+  uint64_t delta =
+      node.expiresTick > currentTick ? node.expiresTick - currentTick : 0;
+  uint64_t maxDelta = (1ull << (LEVELS * SLOT_BITS)) - 1;
+  if (delta > maxDelta) {
+    delta = maxDelta;
+    node.expiresTick = currentTick + maxDelta;
+  }
+
+  int level = 0;
+  while (level < LEVELS - 1 && delta >= (1ull << ((level + 1) * SLOT_BITS))) {
+    ++level;
+  }
+  // A cascaded timer that is due now lands in the slot about to be run.
+  uint64_t tick = delta == 0 ? currentTick : node.expiresTick;
+  int slot = (int)((tick >> (level * SLOT_BITS)) & (SLOTS - 1));
+
+  node.level = (int16_t)level;
+  node.slot = (int16_t)slot;
+  node.prev = NONE;
+  node.next = heads[level][slot];
+  if (node.next != NONE) {
+    nodes[node.next].prev = index;
+  }
+  heads[level][slot] = index;
+}
+
+void TimerWheel::unlink(int32_t index) {
+  Node &node = nodes[index];
+  if (node.prev != NONE) {
+    nodes[node.prev].next = node.next;
+  } else {
+    heads[node.level][node.slot] = node.next;
+  }
+  if (node.next != NONE) {
+    nodes[node.next].prev = node.prev;
+  }
+}
+
+void TimerWheel::release(int32_t index) {
+  Node &node = nodes[index];
+  node.level = -1;
+  node.generation++;
+  if (node.generation == 0) {
+    node.generation = 1;
+  }
+  freeNodes.push_back(index);
+  armed--;
+}
+
+void TimerWheel::cascade(int level, int slot) {
+  int32_t index = heads[level][slot];
+  heads[level][slot] = NONE;
+  while (index != NONE) {
+    int32_t next = nodes[index].next;
+    place(index);
+    index = next;
+  }
+}
+
+void TimerWheel::advance(uint64_t nowMs, std::vector<Expired> &expired) {
+  uint64_t targetTick = nowMs > startMs ? (nowMs - startMs) / tickMs : 0;
+  if (armed == 0) {
+    if (targetTick > currentTick) {
+      currentTick = targetTick;
+    }
+    return;
+  }
+
+  while (currentTick < targetTick && armed > 0) {
+    currentTick++;
+    // When a level wraps, the next slot of the level above comes due.
+    for (int level = 1; level < LEVELS; ++level) {
+      if ((currentTick & ((1ull << (level * SLOT_BITS)) - 1)) != 0) {
+        break;
+      }
+      cascade(level, (int)((currentTick >> (level * SLOT_BITS)) & (SLOTS - 1)));
+    }
+
+    int slot = (int)(currentTick & (SLOTS - 1));
+    int32_t index = heads[0][slot];
+    heads[0][slot] = NONE;
+    while (index != NONE) {
+      int32_t next = nodes[index].next;
+      expired.push_back(Expired{nodes[index].kind, nodes[index].target});
+      release(index);
+      index = next;
+    }
+  }
+  if (currentTick < targetTick) {
+    currentTick = targetTick;
+  }
+}
@@ -1,11 +1,108 @@
 #include "ServerApp.h"
 
+#include <csignal>
 #include <cstdlib>
+#include <cstring>
 #include <ctime>
+#include <iostream>
+#include <memory>
+#include <unistd.h>
 
-int main() {
-  std::srand(std::time(nullptr));
-  ServerApp server;
+static void usage() {
+  std::cerr << "Usage: server [--transport=fifo|shm] [--seed=N] [--touching]"
+            << " [--stats=PATH] [--metrics-file=PATH] [--metrics-interval=SEC]"
+            << " [--log-level=debug|info|warn|error] [--log-sample=N]"
+            << " [--matchmaking=rated|fifo]"
+            << " [--turn-timeout=SEC] [--idle-timeout=SEC]"
+            << " [--shards=K --shard=I] [--max-games=N]"
+            << " [--admin-login=NAME]"
+            << std::endl;
+}
+
+static bool parseLogLevel(const char *name, LogLevel &level) {
+  static const char *NAMES[] = {"debug", "info", "warn", "error"};
+  for (int i = 0; i <= LOG_ERROR; ++i) {
+    if (strcmp(name, NAMES[i]) == 0) {
+      level = (LogLevel)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+int main(int argc, char *argv[]) {
+  ServerOptions options;
+  options.seed = (uint64_t)std::time(nullptr) ^ ((uint64_t)getpid() << 32);
+
+  for (int i = 1; i < argc; ++i) {
+    if (strncmp(argv[i], "--transport=", 12) == 0) {
+      options.transport = argv[i] + 12;
+    } else if (strncmp(argv[i], "--seed=", 7) == 0) {
+      options.seed = strtoull(argv[i] + 7, nullptr, 10);
+    } else if (strncmp(argv[i], "--stats=", 8) == 0) {
+      options.statsPath = argv[i] + 8;
+    } else if (strncmp(argv[i], "--metrics-file=", 15) == 0) {
+      options.metricsFile = argv[i] + 15;
+    } else if (strncmp(argv[i], "--metrics-interval=", 19) == 0) {
+      options.metricsIntervalSec = atoi(argv[i] + 19);
+    } else if (strncmp(argv[i], "--log-level=", 12) == 0) {
+      if (!parseLogLevel(argv[i] + 12, options.logLevel)) {
+        usage();
+        return 1;
+      }
+    } else if (strncmp(argv[i], "--log-sample=", 13) == 0) {
+      options.logSample = atoi(argv[i] + 13);
+    } else if (strcmp(argv[i], "--matchmaking=rated") == 0) {
+      options.ratedMatching = true;
+    } else if (strcmp(argv[i], "--matchmaking=fifo") == 0) {
+      options.ratedMatching = false;
+    } else if (strncmp(argv[i], "--turn-timeout=", 15) == 0) {
+      options.turnTimeoutSec = atoi(argv[i] + 15);
+    } else if (strncmp(argv[i], "--idle-timeout=", 15) == 0) {
+      options.idleTimeoutSec = atoi(argv[i] + 15);
+    } else if (strncmp(argv[i], "--shards=", 9) == 0) {
+      options.shardCount = atoi(argv[i] + 9);
+    } else if (strncmp(argv[i], "--shard=", 8) == 0) {
+      options.shardIndex = atoi(argv[i] + 8);
+    } else if (strncmp(argv[i], "--max-games=", 12) == 0) {
+      options.maxGames = atoi(argv[i] + 12);
+    } else if (strncmp(argv[i], "--admin-login=", 14) == 0) {
+      options.adminLogin = argv[i] + 14;
+    } else if (strcmp(argv[i], "--touching") == 0) {
+      options.noTouching = false;
+    } else {
+      usage();
+      return 1;
+    }
+  }
+
+  if (options.shardCount < 1 || options.shardCount > MAX_SHARDS ||
+      options.shardIndex < 0 || options.shardIndex >= options.shardCount ||
+      options.maxGames < 1) {
+    usage();
+    return 1;
+  }
+  // Each shard keeps the statistics of its own logins. Shard 0 keeps the
+  // plain names, like the transport endpoints.
+  options.statsPath = shardEndpoint(options.statsPath, options.shardIndex);
+  std::string &metrics = options.metricsFile;
+  size_t dot = metrics.rfind('.');
+  if (dot == std::string::npos || metrics.find('/', dot) != std::string::npos) {
+    dot = metrics.size();
+  }
+  metrics = shardEndpoint(metrics.substr(0, dot), options.shardIndex) +
+            metrics.substr(dot);
+
+  std::unique_ptr<ServerTransport> transport(
+      createServerTransport(options.transport));
+  if (!transport) {
+    std::cerr << "Unknown transport '" << options.transport
+              << "', expected fifo or shm." << std::endl;
+    return 1;
+  }
+
+  std::signal(SIGPIPE, SIG_IGN);
+  ServerApp server(*transport, options);
   server.run();
   return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,178 @@
+#include "Simulator.h"
+#include "ShotStrategy.h"
+
+#include <algorithm>
+#include <ctime>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <unistd.h>
+#include <vector>
+
+static uint64_t nowNs() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void Simulator::SideStats::merge(const SideStats &other) {
+  wins += other.wins;
+  shots += other.shots;
+  hits += other.hits;
+  for (int i = 0; i <= MAX_SHOTS; ++i) {
+    shotsToWin[i] += other.shotsToWin[i];
+  }
+}
+
+Simulator::Simulator(const SimulatorOptions &options)
+    : options(options), threadCount(0), elapsedSec(0), nextGame(0) {}
+
+void *Simulator::threadWrapper(void *context) {
+  Thread *thread = (Thread *)context;
+  thread->sim->runThread(thread->totals);
+  return nullptr;
+}
+
+void Simulator::runThread(Totals &local) {
+  std::unique_ptr<ShotStrategy> strategies[2] = {
+      std::unique_ptr<ShotStrategy>(createShotStrategy(options.strategyA)),
+      std::unique_ptr<ShotStrategy>(createShotStrategy(options.strategyB))};
+  ClassicBoard boards[2];
+
+  while (true) {
+    uint64_t first = nextGame.fetch_add(BATCH, std::memory_order_relaxed);
+    if (first >= options.games) {
+      break;
+    }
+    uint64_t last = std::min(first + BATCH, options.games);
+
+    for (uint64_t game = first; game < last; ++game) {
+      Xoshiro256 rng(options.seed + game);
+      for (int side = 0; side < 2; ++side) {
+        boards[side].placeShips(rng, options.noTouching);
+        strategies[side]->reset(rng, options.noTouching);
+      }
+
+      int shots[2] = {0, 0};
+      int turn = game % 2;
+      // A side that keeps repeating itself forfeits instead of looping.
+      while (shots[turn] <= 2 * MAX_SHOTS) {
+        int cell = strategies[turn]->next(rng);
+        ShotResult res = boards[1 - turn].processShot(cell % ClassicBoard::SIZE,
+                                                       cell / ClassicBoard::SIZE);
+        strategies[turn]->onResult(cell, res);
+        shots[turn]++;
+
+        SideStats &stats = local.sides[turn];
+        if (res == RES_HIT || res == RES_SUNK || res == RES_LOSE) {
+          stats.hits++;
+        }
+        if (res == RES_LOSE) {
+          stats.wins++;
+          stats.shotsToWin[std::min(shots[turn], (int)MAX_SHOTS)]++;
+          break;
+        }
+        if (res == RES_MISS) {
+          turn = 1 - turn;
+        }
+      }
+      local.sides[0].shots += shots[0];
+      local.sides[1].shots += shots[1];
+      local.games++;
+    }
+  }
+}
+
+bool Simulator::run() {
+  for (const std::string &name : {options.strategyA, options.strategyB}) {
+    std::unique_ptr<ShotStrategy> probe(createShotStrategy(name));
+    if (!probe) {
+      std::cerr << "Unknown strategy '" << name
+                << "', expected random, hunt or density." << std::endl;
+      return false;
+    }
+  }
+
+  threadCount = options.threads;
+  if (threadCount <= 0) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    threadCount = cores > 0 ? (int)cores : 1;
+  }
+
+  std::vector<Thread> threads(threadCount);
+  nextGame.store(0);
+  uint64_t start = nowNs();
+  int started = 0;
+  for (Thread &t : threads) {
+    t.sim = this;
+    if (pthread_create(&t.thread, nullptr, threadWrapper, &t) != 0) {
+      std::cerr << "Unable to start simulator thread" << std::endl;
+      break;
+    }
+    ++started;
+  }
+
+  totals = Totals();
+  for (int i = 0; i < started; ++i) {
+    pthread_join(threads[i].thread, nullptr);
+    totals.games += threads[i].totals.games;
+    for (int side = 0; side < 2; ++side) {
+      totals.sides[side].merge(threads[i].totals.sides[side]);
+    }
+  }
+  elapsedSec = (nowNs() - start) / 1e9;
+  return started > 0;
+}
+
+std::string Simulator::report() const {
+  std::ostringstream out;
+  out << "{\n";
+  out << "  \"games\": " << totals.games << ",\n";
+  out << "  \"threads\": " << threadCount << ",\n";
+  out << "  \"seed\": " << options.seed << ",\n";
+  out << "  \"no_touching\": " << (options.noTouching ? "true" : "false")
+      << ",\n";
+  out << "  \"elapsed_s\": " << elapsedSec << ",\n";
+  out << "  \"games_per_s\": "
+      << (elapsedSec > 0 ? totals.games / elapsedSec : 0) << ",\n";
+  out << "  \"sides\": {\n";
+
+  for (int side = 0; side < 2; ++side) {
+    const SideStats &stats = totals.sides[side];
+    auto quantile = [&](double q) {
+      uint64_t seen = 0;
+      for (int shots = 0; shots <= MAX_SHOTS; ++shots) {
+        seen += stats.shotsToWin[shots];
+        if (stats.wins > 0 && seen >= q * stats.wins) {
+          return shots;
+        }
+      }
+      return 0;
+    };
+    uint64_t winningShots = 0;
+    int minShots = 0;
+    int maxShots = 0;
+    for (int shots = 0; shots <= MAX_SHOTS; ++shots) {
+      if (stats.shotsToWin[shots] == 0) {
+        continue;
+      }
+      winningShots += stats.shotsToWin[shots] * shots;
+      minShots = minShots == 0 ? shots : minShots;
+      maxShots = shots;
+    }
+
+    out << "    \"" << (side == 0 ? "a" : "b") << "\": {\"strategy\": \""
+        << (side == 0 ? options.strategyA : options.strategyB) << "\""
+        << ", \"wins\": " << stats.wins << ", \"win_rate\": "
+        << (totals.games > 0 ? (double)stats.wins / totals.games : 0)
+        << ", \"hit_rate\": "
+        << (stats.shots > 0 ? (double)stats.hits / stats.shots : 0)
+        << ", \"shots_to_win\": {\"mean\": "
+        << (stats.wins > 0 ? (double)winningShots / stats.wins : 0)
+        << ", \"min\": " << minShots << ", \"p50\": " << quantile(0.5)
+        << ", \"p99\": " << quantile(0.99) << ", \"max\": " << maxShots
+        << "}}" << (side == 0 ? ",\n" : "\n");
+  }
+  out << "  }\n}\n";
+  return out.str();
+}
@@ -0,0 +1,40 @@
+#include "Simulator.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+static void usage() {
+  std::cerr << "Usage: simulator [--games=N] [--threads=N]"
+            << " [--a=random|hunt|density] [--b=random|hunt|density]"
+            << " [--seed=N] [--touching]" << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+  SimulatorOptions options;
+  for (int i = 1; i < argc; ++i) {
+    if (strncmp(argv[i], "--games=", 8) == 0) {
+      options.games = strtoull(argv[i] + 8, nullptr, 10);
+    } else if (strncmp(argv[i], "--threads=", 10) == 0) {
+      options.threads = atoi(argv[i] + 10);
+    } else if (strncmp(argv[i], "--a=", 4) == 0) {
+      options.strategyA = argv[i] + 4;
+    } else if (strncmp(argv[i], "--b=", 4) == 0) {
+      options.strategyB = argv[i] + 4;
+    } else if (strncmp(argv[i], "--seed=", 7) == 0) {
+      options.seed = strtoull(argv[i] + 7, nullptr, 10);
+    } else if (strcmp(argv[i], "--touching") == 0) {
+      options.noTouching = false;
+    } else {
+      usage();
+      return 1;
+    }
+  }
+
+  Simulator simulator(options);
+  if (!simulator.run()) {
+    return 1;
+  }
+  std::cout << simulator.report();
+  return 0;
+}
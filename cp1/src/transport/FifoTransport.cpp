@@ -0,0 +1,359 @@
+#include "FifoTransport.h"
+
+#include <cstring>
+#include <iostream>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+FifoServerTransport::FifoServerTransport()
+    : nextChannelId(SERVER_PIPE_ID + 1), serverPipe(SERVER_PIPE),
+      serverReader(SERVER_READ_BUFFER), epollFd(-1) {
+  channel_mutex = PTHREAD_MUTEX_INITIALIZER;
+}
+
+FifoServerTransport::~FifoServerTransport() {
+  close();
+  pthread_mutex_destroy(&channel_mutex);
+}
+
+bool FifoServerTransport::open() {
+  serverPipe = NamedPipe(shardEndpoint(SERVER_PIPE, shard));
+  serverPipe.removePipe();
+  if (!serverPipe.create()) {
+    std::cerr << "Fatal: Unable to create server pipe. Check access rights."
+              << std::endl;
+    return false;
+  }
+
+  if (!serverPipe.openPipe(O_RDWR | O_NONBLOCK)) {
+    std::cerr << "Fatal: Unable to open pipe." << std::endl;
+    return false;
+  }
+
+  epollFd = epoll_create1(EPOLL_CLOEXEC);
+  if (epollFd == -1) {
+    std::cerr << "Fatal: Unable to create epoll instance." << std::endl;
+    serverPipe.closePipe();
+    return false;
+  }
+
+  epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.u64 = SERVER_PIPE_ID;
+  if (epoll_ctl(epollFd, EPOLL_CTL_ADD, serverPipe.fd, &ev) == -1) {
+    std::cerr << "Fatal: Unable to watch server pipe." << std::endl;
+    ::close(epollFd);
+    epollFd = -1;
+    serverPipe.closePipe();
+    return false;
+  }
+  return true;
+}
+
+void FifoServerTransport::close() {
+  pthread_mutex_lock(&channel_mutex);
+  for (auto &entry : channels) {
+    entry.second.pipe.closePipe();
+  }
+  channels.clear();
+  channelsById.clear();
+  pthread_mutex_unlock(&channel_mutex);
+
+  if (epollFd != -1) {
+    ::close(epollFd);
+    epollFd = -1;
+  }
+  if (serverPipe.fd != -1) {
+    serverPipe.closePipe();
+    serverPipe.removePipe();
+  }
+}
+
+FifoServerTransport::Channel *
+FifoServerTransport::getChannel(const std::string &login) {
+  auto it = channels.find(login);
+  if (it != channels.end()) {
+    return &it->second;
+  }
+
+  NamedPipe pipe(CLIENT_PIPE_PREFIX + login);
+  if (!pipe.openPipe(O_WRONLY | O_NONBLOCK)) {
+    return nullptr;
+  }
+
+  uint64_t id = nextChannelId++;
+  Channel *channel =
+      &channels.emplace(login, Channel{id, login, pipe, {}, false, false})
+           .first->second;
+  channelsById[id] = channel;
+
+  epoll_event ev;
+  ev.events = 0;
+  ev.data.u64 = id;
+  if (epollFd != -1 && epoll_ctl(epollFd, EPOLL_CTL_ADD, pipe.fd, &ev) == -1) {
+    std::cerr << "[Error] epoll_ctl(ADD) failed for player " << login << ": "
+              << strerror(errno) << "\n";
+  }
+  return channel;
+}
+
+void FifoServerTransport::dropChannel(const std::string &login) {
+  auto it = channels.find(login);
+  if (it == channels.end()) {
+    return;
+  }
+
+  if (!it->second.outbound.empty()) {
+    std::cerr << "[Warning] Dropping " << it->second.outbound.size()
+              << " undelivered packets for player " << login << "\n";
+  }
+  if (epollFd != -1) {
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, it->second.pipe.fd, nullptr);
+  }
+  it->second.pipe.closePipe();
+  channelsById.erase(it->second.id);
+  channels.erase(it);
+}
+
+void FifoServerTransport::armWrite(Channel *channel, bool enable) {
+  if (channel->writeArmed == enable || epollFd == -1) {
+    return;
+  }
+
+  epoll_event ev;
+  ev.events = enable ? (uint32_t)EPOLLOUT : 0u;
+  ev.data.u64 = channel->id;
+  if (epoll_ctl(epollFd, EPOLL_CTL_MOD, channel->pipe.fd, &ev) == 0) {
+    channel->writeArmed = enable;
+  }
+}
+
+void FifoServerTransport::flush(Channel *channel) {
+  while (!channel->outbound.empty()) {
+    const std::string &frame = *channel->outbound.front();
+    if (!channel->pipe.send(frame.data(), frame.size())) {
+      if (errno == EAGAIN) {
+        return;
+      }
+      std::cerr << "[Error] Player " << channel->login
+                << " is unreachable (" << strerror(errno)
+                << "), channel dropped\n";
+      dropChannel(channel->login);
+      return;
+    }
+    channel->outbound.pop_front();
+  }
+  if (channel->closing) {
+    dropChannel(channel->login);
+    return;
+  }
+  armWrite(channel, false);
+}
+
+bool FifoServerTransport::connect(const std::string &login) {
+  pthread_mutex_lock(&channel_mutex);
+  auto it = channels.find(login);
+  if (it != channels.end() && it->second.closing) {
+    dropChannel(login);
+  }
+  bool connected = getChannel(login) != nullptr;
+  pthread_mutex_unlock(&channel_mutex);
+  return connected;
+}
+
+void FifoServerTransport::disconnect(const std::string &login) {
+  pthread_mutex_lock(&channel_mutex);
+  dropChannel(login);
+  pthread_mutex_unlock(&channel_mutex);
+}
+
+void FifoServerTransport::disconnectWhenFlushed(const std::string &login) {
+  pthread_mutex_lock(&channel_mutex);
+  auto it = channels.find(login);
+  if (it != channels.end()) {
+    if (it->second.outbound.empty()) {
+      dropChannel(login);
+    } else {
+      it->second.closing = true;
+    }
+  }
+  pthread_mutex_unlock(&channel_mutex);
+}
+
+bool FifoServerTransport::send(const std::string &login, const char *frame,
+                               size_t frameSize) {
+  return enqueue(login, frame, frameSize, nullptr, MAX_OUTBOUND_QUEUE);
+}
+
+bool FifoServerTransport::sendShared(const std::string &login,
+                                     const SharedFrame &frame,
+                                     size_t maxQueued) {
+  return enqueue(login, frame->data(), frame->size(), &frame, maxQueued);
+}
+
+bool FifoServerTransport::enqueue(const std::string &login, const char *frame,
+                                  size_t frameSize, const SharedFrame *shared,
+                                  size_t maxQueued) {
+  pthread_mutex_lock(&channel_mutex);
+
+  Channel *channel = getChannel(login);
+  if (!channel) {
+    std::cerr << "[Error] Failed to send message to player " << login
+              << " (pipe is not available)\n";
+    pthread_mutex_unlock(&channel_mutex);
+    return false;
+  }
+
+  bool delivered = false;
+  if (channel->outbound.empty()) {
+    delivered = channel->pipe.send(frame, frameSize);
+    if (!delivered && errno != EAGAIN) {
+      std::cerr << "[Error] Player " << login << " is unreachable ("
+                << strerror(errno) << "), channel dropped\n";
+      dropChannel(login);
+      pthread_mutex_unlock(&channel_mutex);
+      return false;
+    }
+  }
+
+  bool accepted = true;
+  if (!delivered) {
+    if (shared && channel->outbound.size() >= maxQueued) {
+      accepted = false;
+    } else if (channel->outbound.size() >= MAX_OUTBOUND_QUEUE) {
+      std::cerr << "[Error] Outbound queue of player " << login
+                << " is full, channel dropped\n";
+      dropChannel(login);
+      accepted = false;
+    } else {
+      channel->outbound.push_back(
+          shared ? *shared : std::make_shared<std::string>(frame, frameSize));
+      armWrite(channel, true);
+    }
+  }
+
+  pthread_mutex_unlock(&channel_mutex);
+  return accepted;
+}
+
+void FifoServerTransport::handleChannelEvent(uint64_t id, uint32_t events) {
+  pthread_mutex_lock(&channel_mutex);
+
+  // Ids are never reused, so an event for a channel a worker has already
+  // dropped simply finds nothing.
+  auto it = channelsById.find(id);
+  if (it != channelsById.end()) {
+    Channel *channel = it->second;
+    if (events & (EPOLLERR | EPOLLHUP)) {
+      std::cerr << "[Error] Player " << channel->login
+                << " closed the pipe, channel dropped\n";
+      dropChannel(channel->login);
+    } else if (events & EPOLLOUT) {
+      flush(channel);
+    }
+  }
+
+  pthread_mutex_unlock(&channel_mutex);
+}
+
+void FifoServerTransport::drainServerPipe(TransportListener &listener) {
+  Packet pkt;
+  while (true) {
+    size_t available;
+    char *space = serverReader.reserve(available);
+    ssize_t n = read(serverPipe.fd, space, available);
+    if (n <= 0) {
+      break;
+    }
+    serverReader.commit(n);
+    while (serverReader.next(pkt)) {
+      inbound.push_back(pkt);
+    }
+    // A short read emptied the pipe; skip the read that would only return
+    // EAGAIN.
+    if ((size_t)n < available) {
+      break;
+    }
+  }
+
+  if (!inbound.empty()) {
+    listener.onPackets(inbound);
+    inbound.clear();
+  }
+}
+
+bool FifoServerTransport::poll(int timeoutMs, TransportListener &listener) {
+  epoll_event events[MAX_EVENTS];
+  int n = epoll_wait(epollFd, events, MAX_EVENTS, timeoutMs);
+  if (n == -1) {
+    if (errno == EINTR) {
+      return true;
+    }
+    std::cerr << "Fatal: epoll_wait failed: " << strerror(errno) << std::endl;
+    return false;
+  }
+
+  for (int i = 0; i < n; ++i) {
+    if (events[i].data.u64 == SERVER_PIPE_ID) {
+      drainServerPipe(listener);
+    } else {
+      handleChannelEvent(events[i].data.u64, events[i].events);
+    }
+  }
+  return true;
+}
+
+FifoClientTransport::FifoClientTransport()
+    : inbound(""), outbound(SERVER_PIPE) {}
+
+bool FifoClientTransport::openOutbound() {
+  // O_NONBLOCK makes the open fail with ENXIO instead of hanging when no
+  // server is running; writes block as before.
+  if (!outbound.openPipe(O_WRONLY | O_NONBLOCK)) {
+    return false;
+  }
+  fcntl(outbound.fd, F_SETFL, fcntl(outbound.fd, F_GETFL) & ~O_NONBLOCK);
+  return true;
+}
+
+bool FifoClientTransport::open(const std::string &login) {
+  outbound = NamedPipe(shardEndpoint(SERVER_PIPE, shard));
+  inbound = NamedPipe(CLIENT_PIPE_PREFIX + login);
+  inbound.removePipe();
+  if (!inbound.create() || !inbound.openPipe(O_RDWR)) {
+    return false;
+  }
+  if (!openOutbound()) {
+    close();
+    return false;
+  }
+  return true;
+}
+
+void FifoClientTransport::close() {
+  outbound.closePipe();
+  if (inbound.fd != -1) {
+    inbound.closePipe();
+    inbound.removePipe();
+  }
+}
+
+bool FifoClientTransport::send(const char *frame, size_t frameSize) {
+  if (outbound.send(frame, frameSize)) {
+    return true;
+  }
+  outbound.closePipe();
+  return openOutbound() && outbound.send(frame, frameSize);
+}
+
+ssize_t FifoClientTransport::receive(FrameReader &reader) {
+  pollfd pfd;
+  pfd.fd = inbound.fd;
+  pfd.events = POLLIN;
+  int ready = ::poll(&pfd, 1, RECEIVE_WAIT_MS);
+  if (ready <= 0) {
+    return ready == 0 || errno == EINTR ? 0 : -1;
+  }
+  return reader.fill(inbound.fd);
+}
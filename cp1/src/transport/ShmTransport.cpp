@@ -0,0 +1,457 @@
+#include "ShmTransport.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <iostream>
+#include <linux/futex.h>
+#include <new>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+static const uint32_t SEGMENT_MAGIC = 0x53484d31;
+
+// Segments are shared between processes, so the futex calls must not use the
+// PRIVATE variants.
+static void futexWait(std::atomic<uint32_t> &word, uint32_t expected,
+                      int timeoutMs) {
+  timespec timeout;
+  timespec *timeoutPtr = nullptr;
+  if (timeoutMs >= 0) {
+    timeout.tv_sec = timeoutMs / 1000;
+    timeout.tv_nsec = (long)(timeoutMs % 1000) * 1000000;
+    timeoutPtr = &timeout;
+  }
+  syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAIT, expected,
+          timeoutPtr, nullptr, 0);
+}
+
+static void futexWake(std::atomic<uint32_t> &word) {
+  syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAKE, 1,
+          nullptr, nullptr, 0);
+}
+
+static bool ringPush(ShmRing &ring, const char *data, size_t size) {
+  uint32_t tail = ring.tail.load(std::memory_order_relaxed);
+  uint32_t head = ring.head.load(std::memory_order_acquire);
+  if (ShmRing::SIZE - (tail - head) < size) {
+    return false;
+  }
+
+  uint32_t offset = tail & ShmRing::MASK;
+  size_t first = std::min<size_t>(size, ShmRing::SIZE - offset);
+  memcpy(ring.data + offset, data, first);
+  memcpy(ring.data, data + first, size - first);
+
+  // Pairs with the waiting/tail check in ringWait(): either the consumer sees
+  // the new tail, or this side sees it waiting and wakes it.
+  ring.tail.store(tail + (uint32_t)size);
+  if (ring.waiting.load()) {
+    ring.waiting.store(0);
+    futexWake(ring.tail);
+  }
+  return true;
+}
+
+static size_t ringPop(ShmRing &ring, char *out, size_t maxSize) {
+  uint32_t head = ring.head.load(std::memory_order_relaxed);
+  uint32_t tail = ring.tail.load(std::memory_order_acquire);
+  size_t size = std::min<size_t>(tail - head, maxSize);
+  if (size == 0) {
+    return 0;
+  }
+
+  uint32_t offset = head & ShmRing::MASK;
+  size_t first = std::min<size_t>(size, ShmRing::SIZE - offset);
+  memcpy(out, ring.data + offset, first);
+  memcpy(out + first, ring.data, size - first);
+
+  ring.head.store(head + (uint32_t)size, std::memory_order_release);
+  return size;
+}
+
+static void ringWait(ShmRing &ring, int timeoutMs) {
+  uint32_t head = ring.head.load(std::memory_order_relaxed);
+  ring.waiting.store(1);
+  if (ring.tail.load() == head) {
+    futexWait(ring.tail, head, timeoutMs);
+  }
+  ring.waiting.store(0);
+}
+
+// Drains a ring into a frame reader, handing every complete frame to out.
+static void ringDrain(ShmRing &ring, FrameReader &reader,
+                      std::vector<Packet> &out) {
+  Packet pkt;
+  while (true) {
+    size_t available;
+    char *space = reader.reserve(available);
+    size_t n = ringPop(ring, space, available);
+    reader.commit(n);
+    while (reader.next(pkt)) {
+      out.push_back(pkt);
+    }
+    if (n == 0) {
+      return;
+    }
+  }
+}
+
+static void *mapSegment(const std::string &name, size_t size, bool create) {
+  int fd = create ? shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0666)
+                  : shm_open(name.c_str(), O_RDWR, 0);
+  if (fd == -1) {
+    return nullptr;
+  }
+  if (create && ftruncate(fd, size) == -1) {
+    ::close(fd);
+    shm_unlink(name.c_str());
+    return nullptr;
+  }
+
+  void *addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (addr == MAP_FAILED) {
+    if (create) {
+      shm_unlink(name.c_str());
+    }
+    return nullptr;
+  }
+  return addr;
+}
+
+// The segment mutex is robust, so a client that died while registering does
+// not lock everyone else out.
+static void lockSegment(ShmServerSegment *segment) {
+  if (pthread_mutex_lock(&segment->mutex) == EOWNERDEAD) {
+    pthread_mutex_consistent(&segment->mutex);
+  }
+}
+
+ShmServerTransport::ShmServerTransport() : segment(nullptr) {
+  clients_mutex = PTHREAD_MUTEX_INITIALIZER;
+}
+
+ShmServerTransport::~ShmServerTransport() {
+  close();
+  pthread_mutex_destroy(&clients_mutex);
+}
+
+bool ShmServerTransport::open() {
+  segmentName = shardEndpoint(SHM_SERVER_SEGMENT, shard);
+  shm_unlink(segmentName.c_str());
+  void *addr = mapSegment(segmentName, sizeof(ShmServerSegment), true);
+  if (!addr) {
+    std::cerr << "Fatal: Unable to create shared memory segment "
+              << segmentName << ": " << strerror(errno) << std::endl;
+    return false;
+  }
+
+  segment = new (addr) ShmServerSegment();
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+  pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+  pthread_mutex_init(&segment->mutex, &attr);
+  pthread_mutexattr_destroy(&attr);
+  segment->pendingCount = 0;
+  segment->doorbell.store(0);
+  segment->sleeping.store(0);
+
+  // Clients refuse to register until the magic is in place.
+  segment->magic.store(SEGMENT_MAGIC, std::memory_order_release);
+  return true;
+}
+
+void ShmServerTransport::close() {
+  pthread_mutex_lock(&clients_mutex);
+  for (auto &entry : clients) {
+    munmap(entry.second.segment, sizeof(ShmClientSegment));
+  }
+  clients.clear();
+  pthread_mutex_unlock(&clients_mutex);
+
+  if (segment) {
+    pthread_mutex_destroy(&segment->mutex);
+    munmap(segment, sizeof(ShmServerSegment));
+    segment = nullptr;
+    shm_unlink(segmentName.c_str());
+  }
+}
+
+void ShmServerTransport::acceptRegistrations() {
+  lockSegment(segment);
+  std::vector<std::string> logins;
+  for (int i = 0; i < segment->pendingCount; ++i) {
+    logins.emplace_back(segment->pending[i],
+                        strnlen(segment->pending[i], sizeof(Packet::sender)));
+  }
+  segment->pendingCount = 0;
+  pthread_mutex_unlock(&segment->mutex);
+
+  for (const std::string &login : logins) {
+    void *addr = mapSegment(SHM_CLIENT_SEGMENT_PREFIX + login,
+                            sizeof(ShmClientSegment), false);
+    ShmClientSegment *clientSegment = (ShmClientSegment *)addr;
+    if (!clientSegment ||
+        clientSegment->magic.load(std::memory_order_acquire) != SEGMENT_MAGIC) {
+      std::cerr << "[Error] Unable to map the segment of player " << login
+                << "\n";
+      if (clientSegment) {
+        munmap(clientSegment, sizeof(ShmClientSegment));
+      }
+      continue;
+    }
+
+    // A client that restarted under the same login brings a fresh segment.
+    dropClient(login);
+    clients[login].segment = clientSegment;
+  }
+}
+
+void ShmServerTransport::dropClient(const std::string &login) {
+  auto it = clients.find(login);
+  if (it == clients.end()) {
+    return;
+  }
+
+  if (!it->second.outbound.empty()) {
+    std::cerr << "[Warning] Dropping " << it->second.outbound.size()
+              << " undelivered packets for player " << login << "\n";
+  }
+  munmap(it->second.segment, sizeof(ShmClientSegment));
+  clients.erase(it);
+}
+
+void ShmServerTransport::flush(const std::string &login, Client &client) {
+  while (!client.outbound.empty()) {
+    const std::string &frame = *client.outbound.front();
+    if (!ringPush(client.segment->toClient, frame.data(), frame.size())) {
+      if (kill(client.segment->pid, 0) == -1 && errno == ESRCH) {
+        std::cerr << "[Error] Player " << login
+                  << " is gone, channel dropped\n";
+        dropClient(login);
+      }
+      return;
+    }
+    client.outbound.pop_front();
+  }
+  if (client.closing) {
+    dropClient(login);
+  }
+}
+
+bool ShmServerTransport::poll(int timeoutMs, TransportListener &listener) {
+  // Read the doorbell before looking at the rings: a client that pushes after
+  // the scan also changes the doorbell, and the futex wait returns at once.
+  uint32_t bell = segment->doorbell.load();
+  segment->sleeping.store(1);
+
+  std::vector<Packet> packets;
+  bool retryPending = false;
+
+  pthread_mutex_lock(&clients_mutex);
+  acceptRegistrations();
+  for (auto it = clients.begin(); it != clients.end();) {
+    auto current = it++;
+    ringDrain(current->second.segment->toServer, current->second.reader,
+              packets);
+    flush(current->first, current->second);
+  }
+  for (auto &entry : clients) {
+    retryPending |= !entry.second.outbound.empty();
+  }
+  pthread_mutex_unlock(&clients_mutex);
+
+  if (packets.empty()) {
+    int waitMs = timeoutMs;
+    if (retryPending && (waitMs < 0 || waitMs > RETRY_INTERVAL_MS)) {
+      waitMs = RETRY_INTERVAL_MS;
+    }
+    futexWait(segment->doorbell, bell, waitMs);
+  }
+  segment->sleeping.store(0);
+
+  // Packets are handed over outside clients_mutex, since handlers send.
+  if (!packets.empty()) {
+    listener.onPackets(packets);
+  }
+  return true;
+}
+
+bool ShmServerTransport::connect(const std::string &login) {
+  pthread_mutex_lock(&clients_mutex);
+  bool connected = clients.count(login) > 0;
+  pthread_mutex_unlock(&clients_mutex);
+  return connected;
+}
+
+void ShmServerTransport::disconnect(const std::string &login) {
+  pthread_mutex_lock(&clients_mutex);
+  dropClient(login);
+  pthread_mutex_unlock(&clients_mutex);
+}
+
+void ShmServerTransport::disconnectWhenFlushed(const std::string &login) {
+  pthread_mutex_lock(&clients_mutex);
+  auto it = clients.find(login);
+  if (it != clients.end()) {
+    if (it->second.outbound.empty()) {
+      dropClient(login);
+    } else {
+      it->second.closing = true;
+    }
+  }
+  pthread_mutex_unlock(&clients_mutex);
+}
+
+bool ShmServerTransport::send(const std::string &login, const char *frame,
+                              size_t frameSize) {
+  return enqueue(login, frame, frameSize, nullptr, MAX_OUTBOUND_QUEUE);
+}
+
+bool ShmServerTransport::sendShared(const std::string &login,
+                                    const SharedFrame &frame,
+                                    size_t maxQueued) {
+  return enqueue(login, frame->data(), frame->size(), &frame, maxQueued);
+}
+
+bool ShmServerTransport::enqueue(const std::string &login, const char *frame,
+                                 size_t frameSize, const SharedFrame *shared,
+                                 size_t maxQueued) {
+  pthread_mutex_lock(&clients_mutex);
+
+  auto it = clients.find(login);
+  if (it == clients.end()) {
+    std::cerr << "[Error] Failed to send message to player " << login
+              << " (segment is not available)\n";
+    pthread_mutex_unlock(&clients_mutex);
+    return false;
+  }
+
+  Client &client = it->second;
+  if (client.outbound.empty() &&
+      ringPush(client.segment->toClient, frame, frameSize)) {
+    pthread_mutex_unlock(&clients_mutex);
+    return true;
+  }
+
+  bool accepted = true;
+  if (shared && client.outbound.size() >= maxQueued) {
+    accepted = false;
+  } else if (client.outbound.size() >= MAX_OUTBOUND_QUEUE) {
+    std::cerr << "[Error] Outbound queue of player " << login
+              << " is full, channel dropped\n";
+    dropClient(login);
+    accepted = false;
+  } else {
+    // poll() retries the queue, wake it in case it sleeps without a timeout.
+    client.outbound.push_back(
+        shared ? *shared : std::make_shared<std::string>(frame, frameSize));
+    segment->doorbell.fetch_add(1);
+    if (segment->sleeping.load()) {
+      futexWake(segment->doorbell);
+    }
+  }
+
+  pthread_mutex_unlock(&clients_mutex);
+  return accepted;
+}
+
+ShmClientTransport::ShmClientTransport() : segment(nullptr), server(nullptr) {}
+
+ShmClientTransport::~ShmClientTransport() { close(); }
+
+bool ShmClientTransport::open(const std::string &login) {
+  server = (ShmServerSegment *)mapSegment(
+      shardEndpoint(SHM_SERVER_SEGMENT, shard), sizeof(ShmServerSegment),
+      false);
+  if (!server || server->magic.load(std::memory_order_acquire) != SEGMENT_MAGIC) {
+    close();
+    return false;
+  }
+
+  segmentName = SHM_CLIENT_SEGMENT_PREFIX + login;
+  shm_unlink(segmentName.c_str());
+  void *addr = mapSegment(segmentName, sizeof(ShmClientSegment), true);
+  if (!addr) {
+    close();
+    return false;
+  }
+
+  // ftruncate() zero-fills the segment, which is the empty state of both
+  // rings.
+  segment = (ShmClientSegment *)addr;
+  segment->pid = getpid();
+  segment->magic.store(SEGMENT_MAGIC, std::memory_order_release);
+
+  lockSegment(server);
+  bool registered = server->pendingCount < ShmServerSegment::MAX_PENDING;
+  if (registered) {
+    strncpy(server->pending[server->pendingCount++], login.c_str(),
+            sizeof(Packet::sender) - 1);
+  }
+  pthread_mutex_unlock(&server->mutex);
+
+  if (!registered) {
+    close();
+    return false;
+  }
+  server->doorbell.fetch_add(1);
+  futexWake(server->doorbell);
+  return true;
+}
+
+void ShmClientTransport::close() {
+  if (segment) {
+    munmap(segment, sizeof(ShmClientSegment));
+    segment = nullptr;
+    shm_unlink(segmentName.c_str());
+  }
+  if (server) {
+    munmap(server, sizeof(ShmServerSegment));
+    server = nullptr;
+  }
+}
+
+bool ShmClientTransport::send(const char *frame, size_t frameSize) {
+  if (!segment) {
+    return false;
+  }
+
+  // The server drains rings on every wakeup, a full ring frees up quickly.
+  for (int attempt = 0; !ringPush(segment->toServer, frame, frameSize);
+       ++attempt) {
+    if (attempt == 1000) {
+      return false;
+    }
+    usleep(1000);
+  }
+
+  server->doorbell.fetch_add(1);
+  if (server->sleeping.load()) {
+    futexWake(server->doorbell);
+  }
+  return true;
+}
+
+ssize_t ShmClientTransport::receive(FrameReader &reader) {
+  if (!segment) {
+    return -1;
+  }
+
+  size_t available;
+  char *space = reader.reserve(available);
+  size_t n = ringPop(segment->toClient, space, available);
+  if (n == 0) {
+    ringWait(segment->toClient, RECEIVE_WAIT_MS);
+    n = ringPop(segment->toClient, space, available);
+  }
+  reader.commit(n);
+  return (ssize_t)n;
+}
@@ -0,0 +1,35 @@
+#include "Transport.h"
+#include "FifoTransport.h"
+#include "ShmTransport.h"
+
+std::string shardEndpoint(const std::string &base, int shard) {
+  return shard == 0 ? base : base + "_" + std::to_string(shard);
+}
+
+int loginShard(std::string_view login, int shardCount) {
+  uint32_t hash = 2166136261u;
+  for (char c : login) {
+    hash = (hash ^ (uint8_t)c) * 16777619u;
+  }
+  return shardCount > 1 ? (int)(hash % (uint32_t)shardCount) : 0;
+}
+
+ServerTransport *createServerTransport(const std::string &name) {
+  if (name == "fifo") {
+    return new FifoServerTransport();
+  }
+  if (name == "shm") {
+    return new ShmServerTransport();
+  }
+  return nullptr;
+}
+
+ClientTransport *createClientTransport(const std::string &name) {
+  if (name == "fifo") {
+    return new FifoClientTransport();
+  }
+  if (name == "shm") {
+    return new ShmClientTransport();
+  }
+  return nullptr;
+}